@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "db.h"
+
+// Benchmarks for the engine, linked against it directly. Each workload runs at
+// several table sizes on datasets generated from a fixed seed, so every run
+// inserts the same rows in the same order and numbers can be compared across
+// commits. Reports throughput and the median and 99th percentile latency of
+// the operation timed.
+//
+// Usage: bench [<scratch database file>]
+
+#define BENCH_SEED 0x9e3779b97f4a7c15ull
+#define BENCH_LOOKUPS 100000
+#define BENCH_SCANS 2000
+#define BENCH_CLOSES 50
+#define BENCH_COLD_SCANS 200
+// Each range scan covers the rows whose email starts with the same
+// "user" followed by all but the last BENCH_RANGE_DIGITS digits of the id
+#define BENCH_RANGE_DIGITS 1
+
+const uint32_t table_sizes[] = {10, 100, 1000};
+#define NUM_TABLE_SIZES (sizeof(table_sizes)/sizeof(table_sizes[0]))
+
+typedef struct {
+    uint64_t* samples; // nanoseconds per operation
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t total_ns;
+} Timings;
+
+FILE* report;
+const char* db_path = "build/bench.db";
+uint64_t random_state;
+
+// xorshift64*, reseeded before every dataset
+uint64_t next_random() {
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 0x2545f4914f6cdd1dull;
+}
+
+uint64_t clock_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec*1000000000 + now.tv_nsec;
+}
+
+void timings_init(Timings* timings, uint32_t capacity) {
+    timings->samples = malloc(sizeof(uint64_t)*capacity);
+    timings->count = 0;
+    timings->capacity = capacity;
+    timings->total_ns = 0;
+}
+
+void timings_add(Timings* timings, uint64_t start) {
+    uint64_t elapsed = clock_ns() - start;
+    if (timings->count < timings->capacity) {
+        timings->samples[timings->count++] = elapsed;
+    }
+    timings->total_ns += elapsed;
+}
+
+int compare_samples(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+uint64_t timings_percentile(Timings* timings, double percentile) {
+    uint32_t rank = (uint32_t)(percentile*timings->count);
+    if (rank >= timings->count) {
+        rank = timings->count - 1;
+    }
+    return timings->samples[rank];
+}
+
+void report_timings(const char* workload, uint32_t table_size, Timings* timings) {
+    if (timings->count == 0) {
+        fprintf(report, "%-14s %8u %10s\n", workload, table_size, "-");
+    } else {
+        qsort(timings->samples, timings->count, sizeof(uint64_t), compare_samples);
+        fprintf(report, "%-14s %8u %10u %14.0f %12.2f %12.2f\n", workload, table_size, timings->count,
+                timings->count/(timings->total_ns/1e9),
+                timings_percentile(timings, 0.50)/1e3, timings_percentile(timings, 0.99)/1e3);
+    }
+    fflush(report);
+    free(timings->samples);
+}
+
+void make_row(uint32_t id, Row* row) {
+    row->tenant_id = 0;
+    row->id = id;
+    snprintf(row->username, sizeof(row->username), "u%u", id);
+    snprintf(row->email, sizeof(row->email), "user%08u@example.com", id);
+}
+
+// The ids 1 to n, shuffled with the fixed seed if asked
+uint32_t* make_ids(uint32_t n, bool shuffled) {
+    uint32_t* ids = malloc(sizeof(uint32_t)*n);
+    for (uint32_t i = 0; i < n; i++) {
+        ids[i] = i + 1;
+    }
+    if (shuffled) {
+        random_state = BENCH_SEED ^ n;
+        for (uint32_t i = n - 1; i > 0; i--) {
+            uint32_t j = next_random() % (i + 1);
+            uint32_t id = ids[i];
+            ids[i] = ids[j];
+            ids[j] = id;
+        }
+    }
+    return ids;
+}
+
+Table* open_empty_with(OpenFlags flags) {
+    unlink(db_path);
+    return db_open_with(db_path, flags);
+}
+
+Table* open_empty() {
+    return open_empty_with(DB_OPEN_DEFAULT);
+}
+
+void run_statement(Table* table, const char* sql) {
+    Statement statement;
+    if (statement_prepare(sql, &statement) != PREPARE_SUCCESS ||
+        execute_statement(&statement, table) != EXECUTE_SUCCESS) {
+        fprintf(report, "Unable to run '%s'\n", sql);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Inserts the ids in the order given, stopping early if the table fills up.
+// Returns the number of rows inserted.
+uint32_t insert_rows(Table* table, uint32_t* ids, uint32_t n, Timings* timings) {
+    Row row;
+    for (uint32_t i = 0; i < n; i++) {
+        make_row(ids[i], &row);
+        uint64_t start = clock_ns();
+        ExecuteResult result = execute_insert_row(&row, table);
+        if (result == EXECUTE_TABLE_FULL) {
+            return i;
+        }
+        if (timings != NULL) {
+            timings_add(timings, start);
+        }
+    }
+    return n;
+}
+
+void bench_insert(const char* workload, uint32_t n, bool shuffled) {
+    uint32_t* ids = make_ids(n, shuffled);
+    Table* table = open_empty();
+    Timings timings;
+    timings_init(&timings, n);
+    insert_rows(table, ids, n, &timings);
+    db_close(table);
+    report_timings(workload, n, &timings);
+    free(ids);
+}
+
+// Builds the table read by the lookup and scan workloads by inserting the ids
+// in the order given, with the email column indexed. Returns the number of
+// rows it holds, which are the first that many of the ids.
+uint32_t build_read_table(uint32_t* ids, uint32_t n) {
+    Table* table = open_empty();
+    run_statement(table, "create index on email");
+    uint32_t num_rows = insert_rows(table, ids, n, NULL);
+    db_close(table);
+    return num_rows;
+}
+
+// Point lookups of ids chosen at random from those in the table
+void bench_point_lookups(uint32_t n, uint32_t* ids, uint32_t num_rows) {
+    Timings timings;
+    timings_init(&timings, BENCH_LOOKUPS);
+    Table* table = db_open(db_path);
+    random_state = BENCH_SEED;
+    Row row;
+    for (uint32_t i = 0; i < BENCH_LOOKUPS && num_rows > 0; i++) {
+        uint32_t id = ids[next_random() % num_rows];
+        uint64_t start = clock_ns();
+        if (!db_get(table, id, &row)) {
+            fprintf(report, "Row %u is missing\n", id);
+            exit(EXIT_FAILURE);
+        }
+        timings_add(&timings, start);
+    }
+    db_close(table);
+    report_timings("point_lookup", n, &timings);
+}
+
+// Index range scans over the emails sharing a prefix, and full scans through
+// a cursor
+void bench_scans(uint32_t n, uint32_t* ids, uint32_t num_rows) {
+    Timings range_timings;
+    Timings full_timings;
+    timings_init(&range_timings, BENCH_SCANS);
+    timings_init(&full_timings, BENCH_SCANS);
+    Table* table = db_open(db_path);
+    random_state = BENCH_SEED;
+
+    uint32_t range_rows = 1;
+    for (uint32_t i = 0; i < BENCH_RANGE_DIGITS; i++) {
+        range_rows *= 10;
+    }
+    char sql[64];
+    for (uint32_t i = 0; i < BENCH_SCANS && num_rows > 0; i++) {
+        uint32_t id = ids[next_random() % num_rows];
+        snprintf(sql, sizeof(sql), "select count(*) where email like 'user%0*u%%'",
+                 8 - BENCH_RANGE_DIGITS, id/range_rows);
+        uint64_t start = clock_ns();
+        run_statement(table, sql);
+        timings_add(&range_timings, start);
+    }
+
+    for (uint32_t i = 0; i < BENCH_SCANS && num_rows > 0; i++) {
+        uint64_t start = clock_ns();
+        uint32_t seen = 0;
+        Row row;
+        Cursor cursor;
+        table_start_cursor(table, &cursor);
+        while (!cursor.end_of_table) {
+            deserialize_row(cursor_value(&cursor), &row);
+            seen++;
+            cursor_advance(&cursor);
+        }
+        cursor_close(&cursor);
+        timings_add(&full_timings, start);
+        if (seen != num_rows) {
+            fprintf(report, "Full scan saw %u rows of %u\n", seen, num_rows);
+            exit(EXIT_FAILURE);
+        }
+    }
+    db_close(table);
+    report_timings("range_scan", n, &range_timings);
+    report_timings("full_scan", n, &full_timings);
+}
+
+// Counts through unindexed where clauses, which scan the whole table: a
+// prefix of the username and an exact username, which is not indexed
+void bench_filter_counts(uint32_t n, uint32_t* ids, uint32_t num_rows) {
+    Timings timings;
+    timings_init(&timings, BENCH_SCANS);
+    Table* table = db_open(db_path);
+    random_state = BENCH_SEED;
+    char sql[96];
+    for (uint32_t i = 0; i < BENCH_SCANS && num_rows > 0; i++) {
+        uint32_t id = ids[next_random() % num_rows];
+        if (i % 2 == 0) {
+            snprintf(sql, sizeof(sql), "select count(*) where username like 'u%u%%'", id % 10);
+        } else {
+            snprintf(sql, sizeof(sql), "select count(*) where username = u%u", id);
+        }
+        uint64_t start = clock_ns();
+        run_statement(table, sql);
+        timings_add(&timings, start);
+    }
+    db_close(table);
+    report_timings("filter_count", n, &timings);
+}
+
+// Counts through a where clause no row matches, so every row is read, with
+// the scan split across a thread per core and on one thread. Only tables of
+// more than 8 leaves, about 100 rows, are split, into morsels of 8 leaves, so
+// the largest table here makes about 10 morsels and a full file about 12.
+void bench_parallel_scans(uint32_t n, uint32_t num_rows) {
+    const char* workloads[2] = { "scan_threads", "scan_1_thread" };
+    for (uint32_t single = 0; single < 2; single++) {
+        Timings timings;
+        timings_init(&timings, BENCH_SCANS);
+        Table* table = db_open(db_path);
+        if (single) {
+            db_set_scan_threads(table, 1);
+        }
+        for (uint32_t i = 0; i < BENCH_SCANS && num_rows > 0; i++) {
+            uint64_t start = clock_ns();
+            run_statement(table, "select count(*) where username like 'x%'");
+            timings_add(&timings, start);
+        }
+        db_close(table);
+        report_timings(workloads[single], n, &timings);
+    }
+}
+
+// Full scans that start with nothing cached, timing the open and the scan,
+// of a copy of the read table built and opened as the flags given. Reports the
+// size of the file as a comment, as compressed files read fewer bytes for the
+// pages. Only direct files are read from the device: the others come from the
+// operating system's cache, which holds the whole file after the first scan.
+void bench_cold_scans(const char* workload, uint32_t n, uint32_t* ids, OpenFlags flags) {
+    Table* table = open_empty_with(flags);
+    insert_rows(table, ids, n, NULL);
+    db_close(table);
+    struct stat file;
+    if (stat(db_path, &file) == 0) {
+        fprintf(report, "# %s file %lld bytes\n", workload, (long long)file.st_size);
+    }
+
+    Timings timings;
+    timings_init(&timings, BENCH_COLD_SCANS);
+    for (uint32_t i = 0; i < BENCH_COLD_SCANS; i++) {
+        uint64_t start = clock_ns();
+        table = db_open_with(db_path, flags);
+        Cursor cursor;
+        table_start_cursor(table, &cursor);
+        while (!cursor.end_of_table) {
+            cursor_advance(&cursor);
+        }
+        cursor_close(&cursor);
+        timings_add(&timings, start);
+        db_close(table);
+    }
+    report_timings(workload, n, &timings);
+}
+
+// Opens the table, reads every row so all its pages are cached and times
+// closing it, which writes them all back
+void bench_close(uint32_t n) {
+    Timings timings;
+    timings_init(&timings, BENCH_CLOSES);
+    for (uint32_t i = 0; i < BENCH_CLOSES; i++) {
+        Table* table = db_open(db_path);
+        Cursor cursor;
+        table_start_cursor(table, &cursor);
+        while (!cursor.end_of_table) {
+            cursor_advance(&cursor);
+        }
+        cursor_close(&cursor);
+        uint64_t start = clock_ns();
+        db_close(table);
+        timings_add(&timings, start);
+    }
+    report_timings("close", n, &timings);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 2) {
+        printf("Usage: %s [<scratch database file>]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc == 2) {
+        db_path = argv[1];
+    }
+
+    // Selects print their results, so they go to /dev/null and the report to
+    // what was stdout
+    report = fdopen(dup(fileno(stdout)), "w");
+    if (report == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        printf("Unable to redirect output.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(report, "# %ld cores\n", sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(report, "%-14s %8s %10s %14s %12s %12s\n", "workload", "size", "ops", "ops/s", "p50 us", "p99 us");
+    for (uint32_t i = 0; i < NUM_TABLE_SIZES; i++) {
+        uint32_t n = table_sizes[i];
+        bench_insert("seq_insert", n, false);
+        bench_insert("random_insert", n, true);
+        uint32_t* ids = make_ids(n, true);
+        uint32_t num_rows = build_read_table(ids, n);
+        if (num_rows < n) {
+            fprintf(report, "# table full after %u of %u rows, reads use those\n", num_rows, n);
+        }
+        bench_point_lookups(n, ids, num_rows);
+        bench_scans(n, ids, num_rows);
+        bench_filter_counts(n, ids, num_rows);
+        bench_parallel_scans(n, num_rows);
+        bench_close(n);
+        bench_cold_scans("cold_scan", n, ids, DB_OPEN_DEFAULT);
+        bench_cold_scans("cold_scan_lz", n, ids, DB_OPEN_COMPRESSED);
+        bench_cold_scans("cold_scan_dio", n, ids, DB_OPEN_DIRECT);
+        free(ids);
+    }
+    unlink(db_path);
+    fclose(report);
+    return EXIT_SUCCESS;
+}
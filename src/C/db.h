@@ -0,0 +1,348 @@
+#ifndef DB_H
+#define DB_H
+
+// Public interface of the database engine. Programs embedding the engine link
+// against libdb and call these directly; the db REPL is one such program.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "schema.h"
+
+#define COLUMN_USERNAME_SIZE 12
+#define COLUMN_EMAIL_SIZE 255
+#define TABLE_NAME_SIZE 31
+
+#define ROW_FIELD_INTEGER(name, NAME) uint64_t name;
+#define ROW_FIELD_TEXT(name, NAME, length) char name[length + 1];
+
+// Rows of tables keyed by (tenant_id, id) carry their tenant. It is part of
+// the key rather than one of the columns, and is 0 in tables keyed by id alone.
+typedef struct {
+    uint64_t tenant_id;
+    ROW_COLUMNS(ROW_FIELD_INTEGER, ROW_FIELD_TEXT)
+} Row;
+
+// A row as it is stored in a leaf cell: its tenant and columns back to back,
+// unaligned
+typedef struct __attribute__((packed)) {
+    uint64_t tenant_id;
+    ROW_COLUMNS(ROW_FIELD_INTEGER, ROW_FIELD_TEXT)
+} SerializedRow;
+
+#define size_of_attribute(Struct, Attribute) sizeof(((Struct*)0)-> Attribute)
+
+// <NAME>_SIZE and <NAME>_OFFSET for every column, e.g. EMAIL_OFFSET
+#define ROW_LAYOUT_INTEGER(name, NAME) \
+    NAME##_SIZE = size_of_attribute(SerializedRow, name), \
+    NAME##_OFFSET = offsetof(SerializedRow, name),
+#define ROW_LAYOUT_TEXT(name, NAME, length) ROW_LAYOUT_INTEGER(name, NAME)
+
+enum {
+    ROW_LAYOUT_INTEGER(tenant_id, TENANT_ID)
+    ROW_COLUMNS(ROW_LAYOUT_INTEGER, ROW_LAYOUT_TEXT)
+    ROW_SIZE = sizeof(SerializedRow),
+    PAGE_SIZE = 4096,
+    TABLE_MAX_PAGES = 100,
+};
+
+// The string columns that can be filtered on and indexed, e.g. COLUMN_EMAIL
+#define STRING_COLUMN_ENUM(name, NAME, length) COLUMN_##NAME,
+
+typedef enum {
+    ROW_COLUMNS(ROW_COLUMN_IGNORE, STRING_COLUMN_ENUM)
+    NUM_STRING_COLUMNS
+} StringColumn;
+
+// Table keys are (tenant_id, id), each part big endian, so keys order as
+// their parts do and comparing two is a single memcmp. Tables keyed by id
+// alone have tenant 0 throughout.
+enum {
+    KEY_PART_SIZE = sizeof(uint64_t),
+    TABLE_KEY_SIZE = 2*KEY_PART_SIZE,
+};
+
+// A database file is read and written through its pager, which caches its
+// pages, and the database holds what its tables share. Both are the engine's
+// own, and callers reach them only through the tables they open.
+typedef struct Pager Pager;
+typedef struct Database Database;
+
+// One table in a database file. Handles come from db_open and db_table.
+typedef struct Table Table;
+
+typedef struct {
+    Table* table;
+    uint32_t page_num;
+    uint32_t cell_num;
+    bool end_of_table; //
+    bool in_snapshot; // ended when the cursor is closed
+    bool heap_allocated; // by table_start or table_end, so cursor_close frees it
+} Cursor;
+
+typedef enum {
+    EXECUTE_SUCCESS,
+    EXECUTE_TABLE_FULL,
+    EXECUTE_DUPLICATE_KEY,
+    EXECUTE_INDEX_EXISTS,
+    EXECUTE_NO_TABLE,
+    EXECUTE_TABLE_EXISTS,
+    EXECUTE_DEFAULT_TABLE,
+    EXECUTE_KEY_MISMATCH,
+    EXECUTE_UNBOUND_PARAMETER,
+    EXECUTE_FAILURE
+} ExecuteResult;
+
+typedef enum { 
+        PREPARE_SUCCESS, 
+        PREPARE_NEGATIVE_ID,
+        PREPARE_ID_TOO_LARGE,
+        PREPARE_STRING_TOO_LONG,
+        PREPARE_SYNTAX_ERROR, 
+        PREPARE_UNRECOGNISED_STATEMENT,
+        PREPARE_BAD_PARAMETER,
+} PrepareResult;
+
+typedef enum {
+    STATEMENT_INSERT,
+    STATEMENT_SELECT,
+    STATEMENT_CREATE_INDEX,
+    STATEMENT_CREATE_TABLE,
+    STATEMENT_DROP_TABLE,
+    STATEMENT_FAILED
+} StatementType;
+
+typedef enum { FILTER_NONE, FILTER_EQUALS, FILTER_PREFIX, FILTER_TENANT } FilterType;
+
+// A where clause on one of the string columns, or on the tenant. It is matched
+// against the serialized row bytes so rows that fail it are never deserialised.
+typedef struct {
+    FilterType type;
+    StringColumn column;
+    uint32_t value_length;
+    char value[COLUMN_EMAIL_SIZE + 1];
+    uint64_t tenant_id; // only to be used by FILTER_TENANT
+} Filter;
+
+// Where the value bound to a "?" placeholder goes
+typedef enum {
+    PARAM_TENANT_ID,
+    PARAM_ID,
+    PARAM_USERNAME,
+    PARAM_EMAIL,
+    PARAM_FILTER_VALUE,
+    PARAM_FILTER_TENANT
+} ParamTarget;
+
+#define STATEMENT_MAX_PARAMS 4
+
+// Rows an order by select has matched, being sorted
+typedef struct Sorter Sorter;
+
+#define SELECT_NO_LIMIT UINT32_MAX
+
+// explain prints how a select would find its rows; explain analyze runs it,
+// discarding the rows, and prints what each step read and how long it took
+typedef enum { EXPLAIN_NONE, EXPLAIN_PLAN, EXPLAIN_ANALYZE } ExplainMode;
+
+// The plan a select ran by, and what was measured as it ran
+typedef struct Profile Profile;
+
+typedef struct { 
+    StatementType type; 
+    char table_name[TABLE_NAME_SIZE + 1]; // the table named, or empty for the one executed on
+    Row row_to_insert; // only to be used by insert statement, may be temporary
+    bool with_tenant; // insert gives a tenant_id, or create table keys by one
+    Filter filter; // only to be used by select statement
+    bool count_only; // select count(*)
+    bool ordered; // select ... order by
+    StringColumn order_column;
+    uint32_t limit; // rows a select returns at most, or SELECT_NO_LIMIT
+    uint32_t offset; // rows a select skips before those it returns
+    uint32_t rows_skipped; // so far, while it runs
+    Sorter* sorter; // while an ordered select runs
+    bool joined; // select from <table> join <table> on <column>
+    char join_table_name[TABLE_NAME_SIZE + 1];
+    bool join_on_id; // or else on join_column
+    StringColumn join_column;
+    ExplainMode explain;
+    Profile* profile; // while a select is being explained
+    StringColumn index_column; // only to be used by create index statement
+    uint32_t num_params;
+    ParamTarget params[STATEMENT_MAX_PARAMS];
+    uint32_t bound_params; // bitmask of the params bound so far
+    uint32_t num_rows; // rows inserted or returned by the last execution
+    uint32_t rows_examined; // rows a select read to find those it returned
+} Statement;
+
+// A small direct mapped cache of prepared statements keyed by their text, for
+// callers that issue the same parameterised statements over and over.
+#define STATEMENT_CACHE_SIZE 64
+
+typedef struct {
+    char* sql; // NULL if the slot is empty
+    Statement statement;
+} StatementCacheEntry;
+
+typedef struct {
+    StatementCacheEntry entries[STATEMENT_CACHE_SIZE];
+} StatementCache;
+
+// Counters and latency histograms for everything the engine does in this
+// process. Each thread counts into a block of its own, so counting takes no
+// lock and threads never write the same cache line; db_stats sums the blocks.
+//
+// Latencies are in nanoseconds, bucketed HDR style: each power of two is split
+// into LATENCY_SUB_BUCKETS linear buckets, so a percentile is reported to
+// within an eighth of its value whatever its magnitude.
+#define LATENCY_SUB_BUCKET_BITS 3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BUCKET_BITS + 1)*LATENCY_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+// What is timed: preparing statements, executing them and flushing the cache
+typedef enum { TIMER_PREPARE, TIMER_EXECUTE, TIMER_FLUSH, NUM_TIMERS } StatsTimer;
+
+typedef struct {
+    uint64_t page_hits;
+    uint64_t page_misses;
+    uint64_t pages_read_ahead;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    LatencyHistogram latencies[NUM_TIMERS];
+} DbStats;
+
+void db_stats(DbStats* stats);
+void db_reset_stats();
+uint64_t latency_percentile(LatencyHistogram* histogram, double percentile);
+
+// Opening and closing a database file. db_open returns the file's default
+// table, which is created with the file and cannot be dropped; the others are
+// reached through db_table. db_close writes every cached page back and frees
+// every handle to a table in the file. It must only be called once no other
+// thread is using the file.
+//
+// DB_OPEN_DIRECT bypasses the operating system's page cache with O_DIRECT, so
+// the pager holds the only copy of each page in memory.
+//
+// DB_OPEN_COMPRESSED creates a new file with each page compressed on disk and
+// decompressed as it is read into the cache. Whether a file is compressed is
+// fixed when it is created, so the flag makes no difference to opening an
+// existing one.
+typedef enum { DB_OPEN_DEFAULT = 0, DB_OPEN_DIRECT = 1, DB_OPEN_COMPRESSED = 2 } OpenFlags;
+
+#define DB_DEFAULT_TABLE "users"
+
+Table* db_open(const char* filename);
+Table* db_open_with(const char* filename, OpenFlags flags);
+void db_close(Table* table);
+
+// The named table in the same file as the table given, or NULL if there is
+// none. Handles stay valid until the file is closed, even once their table is
+// dropped, though statements and inserts on a dropped table then fail.
+Table* db_table(Table* table, const char* name);
+
+#define SCAN_MAX_THREADS 64
+#define SORT_DEFAULT_MEMORY (4 << 20)
+#define JOIN_DEFAULT_MEMORY (4 << 20)
+
+// Settings for the file the table is in, and every table in it. Scans use
+// up to num_threads threads, the online cores by default, clamped to between 1
+// and SCAN_MAX_THREADS; it must be set before the file's first parallel scan,
+// which starts its threads. An order by sorts up to bytes in memory before
+// spilling to temporary files, and a join hashes up to bytes before
+// partitioning, SORT_DEFAULT_MEMORY and JOIN_DEFAULT_MEMORY by default.
+void db_set_scan_threads(Table* table, uint32_t num_threads);
+void db_set_sort_memory(Table* table, size_t bytes);
+void db_set_join_memory(Table* table, size_t bytes);
+
+// Transactions. Between db_begin and db_commit, each statement still commits
+// on its own as it runs: other threads see it at once, and a failed statement
+// leaves those before it in place. Nothing written reaches the file until
+// db_commit, or db_close, which write back every cached page, the writes of
+// other threads included, and db_commit waits for them to reach the disk.
+// So once db_commit returns, everything committed before it survives a crash.
+// A crash during it can leave an uncompressed file with some pages written and
+// others not, as there is no journal; a compressed file, whose page map only
+// points at pages once they are on the disk, is left as the last db_commit or
+// db_close to finish left it. db_begin fails if a transaction is already
+// open on the file, and db_commit if none is.
+ExecuteResult db_begin(Table* table);
+ExecuteResult db_commit(Table* table);
+
+// Snapshots. Every read by the calling thread between these sees the table as
+// it was when the snapshot began. Each statement reads a snapshot of its own
+// if none is open. A thread reads one table at a time, and snapshots nest.
+void db_begin_snapshot(Table* table);
+void db_end_snapshot(Table* table);
+
+// Rows
+ExecuteResult execute_insert_row(Row* row_to_insert, Table* table);
+bool db_get(Table* table, uint64_t id, Row* row);
+bool db_get_tenant(Table* table, uint64_t tenant_id, uint64_t id, Row* row);
+void serialize_row(Row* source, void* destination);
+void deserialize_row(void* source, Row* destination);
+
+// Order two serialized rows by one column, e.g. row_compare_email. Integers
+// compare by value and text bytewise, as strcmp does.
+#define ROW_COMPARE_DECLARATION(name, ...) int row_compare_##name(const void* a, const void* b);
+ROW_COLUMNS(ROW_COMPARE_DECLARATION, ROW_COMPARE_DECLARATION)
+
+// Keys are built with encode_key and taken apart with key_tenant_id and key_id
+void encode_key(uint64_t tenant_id, uint64_t id, void* key);
+uint64_t key_tenant_id(const void* key);
+uint64_t key_id(const void* key);
+
+// Cursors walk the table in key order. They are allocated by table_start,
+// table_end and table_find and released with cursor_close. Cursors from
+// table_start and table_find read a snapshot; one from table_end is for the
+// writer, inside a write, and reads what it has written. table_find positions the cursor at the
+// first row whose key is not less than the key given, and table_offset_cursor
+// at the row with the given position in key order, counting from 0, reached
+// in one descent by the row counts kept in internal nodes.
+Cursor* table_start(Table* table);
+Cursor* table_end(Table* table);
+Cursor* table_find(Table* table, const void* key);
+Cursor* table_start_cursor(Table* table, Cursor* cursor);
+Cursor* table_end_cursor(Table* table, Cursor* cursor);
+Cursor* table_find_cursor(Table* table, const void* key, Cursor* cursor);
+Cursor* table_offset_cursor(Table* table, uint64_t offset, Cursor* cursor);
+const void* cursor_key(Cursor* cursor);
+void* cursor_value(Cursor* cursor);
+void cursor_advance(Cursor* cursor);
+void cursor_close(Cursor* cursor);
+
+// Statements
+PrepareResult statement_prepare(const char* sql, Statement* statement);
+PrepareResult statement_bind_id(Statement* statement, uint32_t param, uint64_t id);
+PrepareResult statement_bind_text(Statement* statement, uint32_t param, const char* value);
+ExecuteResult execute_statement(Statement* statement, Table* table);
+StatementCache* new_statement_cache();
+void close_statement_cache(StatementCache* cache);
+PrepareResult statement_cache_prepare(StatementCache* cache, const char* sql, Statement* statement);
+
+// Pages. No page is ever latched: readers get the versions in their snapshot,
+// and the one writer, holding the database's write lock, its own copies. The
+// writer changes pages only through get_page_for_write.
+void* get_page(Pager* pager, uint32_t page_num);
+void* get_page_for_write(Pager* pager, uint32_t page_num);
+
+// Diagnostics
+void print_constants();
+void print_leaf_node(void* node);
+void print_tree(Table* table);
+void print_tables(Table* table);
+void print_row(Row* row);
+void print_stats(DbStats* stats);
+// One "name value" line per counter and timer, for scripts to parse
+void write_stats(FILE* file, DbStats* stats);
+
+#endif
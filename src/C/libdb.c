@@ -0,0 +1,5709 @@
+#ifndef _WIN32
+    #define _GNU_SOURCE // for O_DIRECT
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifdef _WIN32
+    #include <io.h>
+    #include <malloc.h>
+    #include <windows.h>
+    #define open _open
+    #define close _close
+    #define read _read
+    #define write _write
+    #define lseek _lseek
+    #define fsync _commit
+    #define O_RDWR _O_RDWR
+    #define O_CREAT _O_CREAT
+    #define S_IRUSR _S_IRUSR 
+    #define S_IWUSR _S_IWUSR 
+    #define O_DIRECT 0 // not available, so direct mode still goes through the cache
+
+    // No positioned I/O here, so seek and then read or write
+    ssize_t pread(int fd, void* buffer, size_t count, off_t offset) {
+        if (_lseek(fd, offset, SEEK_SET) == -1) {
+            return -1;
+        }
+        return _read(fd, buffer, count);
+    }
+
+    ssize_t pwrite(int fd, const void* buffer, size_t count, off_t offset) {
+        if (_lseek(fd, offset, SEEK_SET) == -1) {
+            return -1;
+        }
+        return _write(fd, buffer, count);
+    }
+#else
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/types.h>
+#endif
+
+// io_uring is used where the headers are available, unless built with -DDB_NO_IO_URING
+#if defined(__linux__) && !defined(DB_NO_IO_URING)
+    #define DB_IO_URING
+    #include <linux/io_uring.h>
+    #include <sys/syscall.h>
+#endif
+
+#include "db.h"
+
+// A committed version of a page. Versions are never changed once published:
+// the writer changes its own copy of a page and publishes the copy as a newer
+// version when its statement commits.
+typedef struct PageVersion {
+    void* data;
+    uint64_t version; // the commit that wrote it
+    struct PageVersion* older;
+} PageVersion;
+
+#define PAGER_MAX_SNAPSHOTS 256
+
+// Batches page reads and writes into single submissions where the kernel
+// supports io_uring. Pagers without one use pread and pwrite.
+typedef struct IoRing IoRing;
+
+// Page buffers and version records are carved out of large chunks rather than
+// allocated one at a time
+typedef struct Slab Slab;
+
+// Where each page of a compressed file is stored
+typedef struct PageMap PageMap;
+
+// Misses on consecutive pages start reading this many pages ahead
+#define READ_AHEAD_PAGES 8
+#define READ_AHEAD_QUEUE_SIZE 32
+
+// Many threads may read through a pager while one writes. Readers each read a
+// snapshot: the newest version of every page committed no later than the
+// snapshot began, so they never wait for the writer nor it for them. Versions
+// older than the oldest open snapshot are freed as the writer commits.
+// Cache misses read the file outside lock and publish under it, while hits
+// read pages[] without it. A helper thread loads pages ahead of scans.
+struct Pager {
+    int file_descriptor;
+    uint32_t file_length; // as if stored uncompressed
+    uint32_t num_pages;
+    PageVersion* pages[TABLE_MAX_PAGES]; // newest committed version of each page
+    void* uncommitted[TABLE_MAX_PAGES]; // the writer's copies of the pages it changed
+    uint64_t committed_version;
+    pthread_mutex_t lock;
+    pthread_mutex_t snapshot_lock;
+    bool snapshot_open[PAGER_MAX_SNAPSHOTS];
+    uint64_t snapshot_versions[PAGER_MAX_SNAPSHOTS];
+    uint32_t last_miss;
+    uint32_t read_ahead_queue[READ_AHEAD_QUEUE_SIZE]; // pages for the helper, under lock
+    uint32_t read_ahead_head;
+    uint32_t read_ahead_tail;
+    bool read_ahead_running;
+    bool read_ahead_closing;
+    pthread_t read_ahead_thread;
+    pthread_cond_t read_ahead_ready;
+    IoRing* io_ring; // NULL without io_uring
+    bool direct_io;
+    PageMap* page_map; // NULL unless the file is compressed
+    Slab* page_slab;
+    Slab* version_slab;
+};
+
+// Workers for parallel scans, started on the first scan that can use them
+typedef struct ThreadPool ThreadPool;
+
+// Deepest a table or index B-tree may grow
+#define TREE_MAX_DEPTH 16
+
+// A database file and the tables in it. Its tables all change the same pager,
+// so writes to any of them take the one write lock.
+struct Database {
+    Pager* pager;
+    bool in_transaction;
+    pthread_mutex_t write_lock; // held by the one thread writing to the file
+    uint32_t scan_threads; // threads a full scan may use, the online cores by default, at most SCAN_MAX_THREADS
+    pthread_mutex_t scan_pool_lock; // held while starting the scan pool
+    ThreadPool* scan_pool;
+    size_t sort_memory; // SORT_DEFAULT_MEMORY unless changed
+    size_t join_memory; // JOIN_DEFAULT_MEMORY unless changed
+    Table* catalog; // the tables in the file, kept in a table of its own
+    pthread_mutex_t tables_lock;
+    Table* tables; // the handles made so far
+    uint32_t next_table_id; // above every id used since the file was opened
+};
+
+// One table in a database file
+struct Table {
+    Database* db;
+    Pager* pager; // the database's
+    uint32_t id; // the table's key in the catalog
+    char name[TABLE_NAME_SIZE + 1];
+    uint32_t root_page_num;
+    bool keyed_by_tenant; // by (tenant_id, id) rather than id
+    // The writer's path to the rightmost leaf, for appending without a descent
+    uint32_t rightmost_leaf; // 0 if not known
+    uint32_t rightmost_depth;
+    uint32_t rightmost_path[TREE_MAX_DEPTH];
+    Table* next; // in the database's list of handles
+};
+
+// This section is the temporary code for storing an in-memory row based database
+enum {
+    // Common Node Header Layout
+    NODE_TYPE_SIZE = sizeof(uint8_t),
+    NODE_TYPE_OFFSET = 0,
+    IS_ROOT_SIZE = sizeof(uint8_t),
+    IS_ROOT_OFFSET = NODE_TYPE_SIZE,
+    PARENT_POINTER_SIZE = sizeof(uint32_t),
+    PARENT_POINTER_OFFSET = NODE_TYPE_SIZE+IS_ROOT_SIZE,
+    COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE+IS_ROOT_SIZE+PARENT_POINTER_SIZE,
+
+    // Leaf Node Header Layout
+    LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t),
+    LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE,
+    LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t),
+    LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET+LEAF_NODE_NUM_CELLS_SIZE,
+    LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE+LEAF_NODE_NUM_CELLS_SIZE+LEAF_NODE_NEXT_LEAF_SIZE,
+
+    // Leaf Node Body Layout
+    LEAF_NODE_KEY_SIZE = TABLE_KEY_SIZE,
+    LEAF_NODE_KEY_OFFSET = 0,
+    LEAF_NODE_VALUE_SIZE = ROW_SIZE,
+    LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET+ LEAF_NODE_KEY_SIZE,
+    LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE+LEAF_NODE_VALUE_SIZE,
+    LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE-LEAF_NODE_HEADER_SIZE,
+    LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS/LEAF_NODE_CELL_SIZE,
+    LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS+1)/2,
+    LEAF_NODE_LEFT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS+1)-LEAF_NODE_RIGHT_SPLIT_COUNT,
+    // Appends past the last key split 90/10
+    LEAF_NODE_APPEND_LEFT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS+1)*9/10,
+
+    // Internal Node Header Layout
+    INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t),
+    INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE,
+    INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t),
+    INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET+INTERNAL_NODE_NUM_KEYS_SIZE,
+    INTERNAL_NODE_RIGHT_ROWS_SIZE = sizeof(uint32_t),
+    INTERNAL_NODE_RIGHT_ROWS_OFFSET = INTERNAL_NODE_RIGHT_CHILD_OFFSET+INTERNAL_NODE_RIGHT_CHILD_SIZE,
+    INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE+INTERNAL_NODE_NUM_KEYS_SIZE+INTERNAL_NODE_RIGHT_CHILD_SIZE
+        +INTERNAL_NODE_RIGHT_ROWS_SIZE,
+
+    // Internal Node Body Layout. A cell is a child, the rows under it and a key.
+    INTERNAL_NODE_KEY_SIZE = TABLE_KEY_SIZE,
+    INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t),
+    INTERNAL_NODE_ROWS_SIZE = sizeof(uint32_t),
+    INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE+INTERNAL_NODE_ROWS_SIZE+INTERNAL_NODE_KEY_SIZE,
+    INTERNAL_NODE_MAX_KEYS = (PAGE_SIZE-INTERNAL_NODE_HEADER_SIZE)/INTERNAL_NODE_CELL_SIZE,
+
+    // Database Header Layout (page 0)
+    DB_HEADER_PAGE_NUM = 0,
+    DB_HEADER_MAGIC_SIZE = sizeof(uint32_t),
+    DB_HEADER_MAGIC_OFFSET = 0,
+    DB_HEADER_FORMAT_SIZE = sizeof(uint32_t),
+    DB_HEADER_FORMAT_OFFSET = DB_HEADER_MAGIC_OFFSET+DB_HEADER_MAGIC_SIZE,
+    DB_HEADER_CATALOG_ROOT_SIZE = sizeof(uint32_t),
+    DB_HEADER_CATALOG_ROOT_OFFSET = DB_HEADER_FORMAT_OFFSET+DB_HEADER_FORMAT_SIZE,
+    DB_HEADER_NUM_FREE_PAGES_SIZE = sizeof(uint32_t),
+    DB_HEADER_NUM_FREE_PAGES_OFFSET = DB_HEADER_CATALOG_ROOT_OFFSET+DB_HEADER_CATALOG_ROOT_SIZE,
+    DB_HEADER_FREE_PAGE_SIZE = sizeof(uint32_t),
+    DB_HEADER_FREE_PAGES_OFFSET = DB_HEADER_NUM_FREE_PAGES_OFFSET+DB_HEADER_NUM_FREE_PAGES_SIZE,
+    DB_HEADER_SIZE = DB_HEADER_FREE_PAGES_OFFSET+TABLE_MAX_PAGES*DB_HEADER_FREE_PAGE_SIZE,
+
+    // Catalog Record Layout. Records are the values of the catalog's cells, so
+    // they take up ROW_SIZE bytes whatever they hold.
+    CATALOG_NAME_SIZE = TABLE_NAME_SIZE+1,
+    CATALOG_NAME_OFFSET = 0,
+    CATALOG_ROOT_SIZE = sizeof(uint32_t),
+    CATALOG_ROOT_OFFSET = CATALOG_NAME_OFFSET+CATALOG_NAME_SIZE,
+    CATALOG_KEY_PARTS_SIZE = sizeof(uint32_t),
+    CATALOG_KEY_PARTS_OFFSET = CATALOG_ROOT_OFFSET+CATALOG_ROOT_SIZE,
+    CATALOG_INDEX_ROOT_SIZE = sizeof(uint32_t),
+    CATALOG_INDEX_ROOTS_OFFSET = CATALOG_KEY_PARTS_OFFSET+CATALOG_KEY_PARTS_SIZE,
+    CATALOG_NUM_COLUMNS_SIZE = sizeof(uint32_t),
+    CATALOG_NUM_COLUMNS_OFFSET = CATALOG_INDEX_ROOTS_OFFSET+NUM_STRING_COLUMNS*CATALOG_INDEX_ROOT_SIZE,
+    CATALOG_COLUMNS_OFFSET = CATALOG_NUM_COLUMNS_OFFSET+CATALOG_NUM_COLUMNS_SIZE,
+    CATALOG_COLUMN_NAME_SIZE = 16,
+    CATALOG_COLUMN_NAME_OFFSET = 0,
+    CATALOG_COLUMN_TYPE_SIZE = sizeof(uint32_t),
+    CATALOG_COLUMN_TYPE_OFFSET = CATALOG_COLUMN_NAME_OFFSET+CATALOG_COLUMN_NAME_SIZE,
+    CATALOG_COLUMN_LENGTH_SIZE = sizeof(uint32_t),
+    CATALOG_COLUMN_LENGTH_OFFSET = CATALOG_COLUMN_TYPE_OFFSET+CATALOG_COLUMN_TYPE_SIZE,
+    CATALOG_COLUMN_SIZE = CATALOG_COLUMN_NAME_SIZE+CATALOG_COLUMN_TYPE_SIZE+CATALOG_COLUMN_LENGTH_SIZE,
+    CATALOG_MAX_COLUMNS = (ROW_SIZE-CATALOG_COLUMNS_OFFSET)/CATALOG_COLUMN_SIZE,
+
+    // Index Leaf Node Header Layout
+    INDEX_LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t),
+    INDEX_LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE,
+    INDEX_LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t),
+    INDEX_LEAF_NODE_NEXT_LEAF_OFFSET = INDEX_LEAF_NODE_NUM_CELLS_OFFSET+INDEX_LEAF_NODE_NUM_CELLS_SIZE,
+    INDEX_LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE+INDEX_LEAF_NODE_NUM_CELLS_SIZE+INDEX_LEAF_NODE_NEXT_LEAF_SIZE,
+
+    // Index Internal Node Header Layout
+    INDEX_INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t),
+    INDEX_INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE,
+    INDEX_INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t),
+    INDEX_INTERNAL_NODE_RIGHT_CHILD_OFFSET = INDEX_INTERNAL_NODE_NUM_KEYS_OFFSET+INDEX_INTERNAL_NODE_NUM_KEYS_SIZE,
+    INDEX_INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE+INDEX_INTERNAL_NODE_NUM_KEYS_SIZE+INDEX_INTERNAL_NODE_RIGHT_CHILD_SIZE,
+
+    // Index Body Layout. An entry is the column bytes followed by the row id,
+    // a leaf cell is an entry and an internal cell is a child pointer and an entry.
+    INDEX_ENTRY_KEY_SIZE = TABLE_KEY_SIZE,
+    INDEX_ENTRY_MAX_SIZE = EMAIL_SIZE+INDEX_ENTRY_KEY_SIZE,
+    INDEX_INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t),
+};
+
+#define DB_HEADER_MAGIC 0x62645f43 // "C_db"
+// Bumped whenever the file layout changes. Files from before the catalog are
+// format 1, those with 32-bit keys format 2, those without row counts in
+// internal nodes format 3, and those without a free page list format 4.
+#define DB_FORMAT_VERSION 5
+_Static_assert((uint32_t)DB_HEADER_SIZE <= PAGE_SIZE, "the header must fit in a page");
+// The catalog's root, which like every root stays where it is
+#define CATALOG_ROOT_PAGE_NUM 1
+
+#define STRING_COLUMN_OFFSET(name, NAME, length) NAME##_OFFSET,
+#define STRING_COLUMN_SIZE(name, NAME, length) NAME##_SIZE,
+#define STRING_COLUMN_NAME(name, NAME, length) #name,
+
+const uint32_t string_column_offsets[NUM_STRING_COLUMNS] = {
+    ROW_COLUMNS(ROW_COLUMN_IGNORE, STRING_COLUMN_OFFSET)
+};
+const uint32_t string_column_sizes[NUM_STRING_COLUMNS] = {
+    ROW_COLUMNS(ROW_COLUMN_IGNORE, STRING_COLUMN_SIZE)
+};
+const char* string_column_names[NUM_STRING_COLUMNS] = {
+    ROW_COLUMNS(ROW_COLUMN_IGNORE, STRING_COLUMN_NAME)
+};
+
+uint32_t string_column_offset(StringColumn column) {
+    return string_column_offsets[column];
+}
+
+// Serialized size of the column, including the null terminator
+uint32_t string_column_size(StringColumn column) {
+    return string_column_sizes[column];
+}
+
+typedef enum {NODE_INTERNAL, NODE_LEAF} NodeType;
+
+NodeType get_node_type(void* node) {
+    uint8_t value = *((uint8_t*)(node + NODE_TYPE_OFFSET));
+    return (NodeType)value;
+}
+
+void set_node_type(void* node, NodeType type) {
+    uint8_t value = type;
+    *((uint8_t*)(node + NODE_TYPE_OFFSET)) = value;
+}
+
+void set_node_root(void* node, bool is_root) {
+    uint8_t value = is_root;
+    *((uint8_t*)(node + IS_ROOT_OFFSET)) = value;
+}
+
+uint32_t* header_magic(void* header) {
+    return header + DB_HEADER_MAGIC_OFFSET;
+}
+
+uint32_t* header_format(void* header) {
+    return header + DB_HEADER_FORMAT_OFFSET;
+}
+
+uint32_t* header_catalog_root(void* header) {
+    return header + DB_HEADER_CATALOG_ROOT_OFFSET;
+}
+
+// The pages no table or index uses, which new nodes take before the file grows
+uint32_t* header_num_free_pages(void* header) {
+    return header + DB_HEADER_NUM_FREE_PAGES_OFFSET;
+}
+
+uint32_t* header_free_page(void* header, uint32_t i) {
+    return header + DB_HEADER_FREE_PAGES_OFFSET + i*DB_HEADER_FREE_PAGE_SIZE;
+}
+
+uint32_t* leaf_node_num_cells(void* node) {
+    return node+LEAF_NODE_NUM_CELLS_OFFSET;
+}
+
+void* leaf_node_cell(void* node, uint32_t cell_num) {
+    return node + LEAF_NODE_HEADER_SIZE + cell_num*LEAF_NODE_CELL_SIZE;
+}
+
+void* leaf_node_key(void* node, uint32_t cell_num) {
+    return leaf_node_cell(node, cell_num);
+}
+
+void* leaf_node_value(void* node, uint32_t cell_num) {
+    return leaf_node_cell(node, cell_num) + LEAF_NODE_VALUE_OFFSET;
+}
+
+// Page number of the next leaf to the right, or 0 for the rightmost leaf
+uint32_t* leaf_node_next_leaf(void* node) {
+    return node + LEAF_NODE_NEXT_LEAF_OFFSET;
+}
+
+void initialize_leaf_node(void* node) {
+    set_node_type(node, NODE_LEAF);
+    set_node_root(node, false);
+    *leaf_node_num_cells(node) = 0;
+    *leaf_node_next_leaf(node) = 0;
+}
+
+uint32_t* internal_node_num_keys(void* node) {
+    return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
+}
+
+uint32_t* internal_node_right_child(void* node) {
+    return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+}
+
+uint32_t* internal_node_cell(void* node, uint32_t cell_num) {
+    return node + INTERNAL_NODE_HEADER_SIZE + cell_num*INTERNAL_NODE_CELL_SIZE;
+}
+
+// Child pointers run one past the keys, the last one being the right child
+uint32_t* internal_node_child(void* node, uint32_t child_num) {
+    if (child_num == *internal_node_num_keys(node)) {
+        return internal_node_right_child(node);
+    }
+    return internal_node_cell(node, child_num);
+}
+
+// The rows in the subtree under each child, kept alongside the child pointers
+uint32_t* internal_node_child_rows(void* node, uint32_t child_num) {
+    if (child_num == *internal_node_num_keys(node)) {
+        return node + INTERNAL_NODE_RIGHT_ROWS_OFFSET;
+    }
+    return (void*)internal_node_cell(node, child_num) + INTERNAL_NODE_CHILD_SIZE;
+}
+
+void* internal_node_key(void* node, uint32_t key_num) {
+    return (void*)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_ROWS_SIZE;
+}
+
+void initialize_internal_node(void* node) {
+    set_node_type(node, NODE_INTERNAL);
+    set_node_root(node, false);
+    *internal_node_num_keys(node) = 0;
+}
+
+uint32_t* index_leaf_node_num_cells(void* node) {
+    return node + INDEX_LEAF_NODE_NUM_CELLS_OFFSET;
+}
+
+// Page number of the next leaf to the right, or 0 for the rightmost leaf
+uint32_t* index_leaf_node_next_leaf(void* node) {
+    return node + INDEX_LEAF_NODE_NEXT_LEAF_OFFSET;
+}
+
+void* index_leaf_node_entry(void* node, uint32_t entry_size, uint32_t cell_num) {
+    return node + INDEX_LEAF_NODE_HEADER_SIZE + cell_num*entry_size;
+}
+
+uint32_t index_leaf_node_max_cells(uint32_t entry_size) {
+    return (PAGE_SIZE - INDEX_LEAF_NODE_HEADER_SIZE)/entry_size;
+}
+
+uint32_t* index_internal_node_num_keys(void* node) {
+    return node + INDEX_INTERNAL_NODE_NUM_KEYS_OFFSET;
+}
+
+uint32_t* index_internal_node_right_child(void* node) {
+    return node + INDEX_INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+}
+
+void* index_internal_node_cell(void* node, uint32_t entry_size, uint32_t cell_num) {
+    return node + INDEX_INTERNAL_NODE_HEADER_SIZE + cell_num*(INDEX_INTERNAL_NODE_CHILD_SIZE+entry_size);
+}
+
+// Child pointers run one past the keys, the last one being the right child
+uint32_t* index_internal_node_child(void* node, uint32_t entry_size, uint32_t child_num) {
+    if (child_num == *index_internal_node_num_keys(node)) {
+        return index_internal_node_right_child(node);
+    }
+    return index_internal_node_cell(node, entry_size, child_num);
+}
+
+void* index_internal_node_entry(void* node, uint32_t entry_size, uint32_t key_num) {
+    return index_internal_node_cell(node, entry_size, key_num) + INDEX_INTERNAL_NODE_CHILD_SIZE;
+}
+
+uint32_t index_internal_node_max_keys(uint32_t entry_size) {
+    return (PAGE_SIZE - INDEX_INTERNAL_NODE_HEADER_SIZE)/(INDEX_INTERNAL_NODE_CHILD_SIZE+entry_size);
+}
+
+void initialize_index_leaf_node(void* node) {
+    set_node_type(node, NODE_LEAF);
+    set_node_root(node, false);
+    *index_leaf_node_num_cells(node) = 0;
+    *index_leaf_node_next_leaf(node) = 0;
+}
+
+void initialize_index_internal_node(void* node) {
+    set_node_type(node, NODE_INTERNAL);
+    set_node_root(node, false);
+    *index_internal_node_num_keys(node) = 0;
+}
+
+// The types a column can have
+typedef enum { COLUMN_TYPE_INTEGER, COLUMN_TYPE_TEXT } ColumnType;
+
+char* catalog_name(void* record) {
+    return record + CATALOG_NAME_OFFSET;
+}
+
+uint32_t* catalog_root(void* record) {
+    return record + CATALOG_ROOT_OFFSET;
+}
+
+// 2 for tables keyed by (tenant_id, id), 1 for those keyed by id
+uint32_t* catalog_key_parts(void* record) {
+    return record + CATALOG_KEY_PARTS_OFFSET;
+}
+
+// Root page of the table's index on the column, or 0 if it is not indexed
+uint32_t* catalog_index_root(void* record, StringColumn column) {
+    return record + CATALOG_INDEX_ROOTS_OFFSET + column*CATALOG_INDEX_ROOT_SIZE;
+}
+
+uint32_t* catalog_num_columns(void* record) {
+    return record + CATALOG_NUM_COLUMNS_OFFSET;
+}
+
+void* catalog_column(void* record, uint32_t column_num) {
+    return record + CATALOG_COLUMNS_OFFSET + column_num*CATALOG_COLUMN_SIZE;
+}
+
+char* catalog_column_name(void* column) {
+    return column + CATALOG_COLUMN_NAME_OFFSET;
+}
+
+uint32_t* catalog_column_type(void* column) {
+    return column + CATALOG_COLUMN_TYPE_OFFSET;
+}
+
+// Bytes for an integer, the longest value for text
+uint32_t* catalog_column_length(void* column) {
+    return column + CATALOG_COLUMN_LENGTH_OFFSET;
+}
+
+typedef struct {
+    const char* name;
+    ColumnType type;
+    uint32_t length;
+} ColumnDefinition;
+
+#define COLUMN_DEFINITION_INTEGER(name, NAME) { #name, COLUMN_TYPE_INTEGER, NAME##_SIZE },
+#define COLUMN_DEFINITION_TEXT(name, NAME, length) { #name, COLUMN_TYPE_TEXT, length },
+
+// The columns of Row, which every table has for now
+const ColumnDefinition row_columns[] = {
+    ROW_COLUMNS(COLUMN_DEFINITION_INTEGER, COLUMN_DEFINITION_TEXT)
+};
+
+#define NUM_ROW_COLUMNS (sizeof(row_columns)/sizeof(row_columns[0]))
+
+// A record for a table with the columns of Row and no indexes
+void initialize_catalog_record(void* record, const char* name, uint32_t root_page_num, bool keyed_by_tenant) {
+    memset(record, 0, ROW_SIZE);
+    strncpy(catalog_name(record), name, TABLE_NAME_SIZE);
+    *catalog_root(record) = root_page_num;
+    *catalog_key_parts(record) = keyed_by_tenant ? 2 : 1;
+    *catalog_num_columns(record) = NUM_ROW_COLUMNS;
+    for (uint32_t i = 0; i < NUM_ROW_COLUMNS; i++) {
+        void* column = catalog_column(record, i);
+        strncpy(catalog_column_name(column), row_columns[i].name, CATALOG_COLUMN_NAME_SIZE - 1);
+        *catalog_column_type(column) = row_columns[i].type;
+        *catalog_column_length(column) = row_columns[i].length;
+    }
+}
+
+// True if the table's columns are those of Row, the only ones this build reads
+bool catalog_columns_match(void* record) {
+    if (*catalog_num_columns(record) != NUM_ROW_COLUMNS) {
+        return false;
+    }
+    for (uint32_t i = 0; i < NUM_ROW_COLUMNS; i++) {
+        void* column = catalog_column(record, i);
+        if (strncmp(catalog_column_name(column), row_columns[i].name, CATALOG_COLUMN_NAME_SIZE) != 0
+                || *catalog_column_type(column) != row_columns[i].type
+                || *catalog_column_length(column) != row_columns[i].length) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The row codecs are expanded once per column, each copy with the column's
+// offset and size as constants. Integers are a single unaligned load or store.
+// Text is stored zero padded past its terminator, so rows with the same values
+// serialize to the same bytes.
+#define ROW_TENANT_ID(INTEGER) INTEGER(tenant_id, TENANT_ID)
+
+#define SERIALIZE_INTEGER(name, NAME) \
+    memcpy(destination + NAME##_OFFSET, &(source->name), NAME##_SIZE);
+#define SERIALIZE_TEXT(name, NAME, length) { \
+        size_t name##_length = strnlen(source->name, length); \
+        memcpy(destination + NAME##_OFFSET, source->name, name##_length); \
+        memset(destination + NAME##_OFFSET + name##_length, 0, NAME##_SIZE - name##_length); \
+    }
+
+#define DESERIALIZE_COLUMN(name, NAME, ...) \
+    memcpy(&(destination->name), source + NAME##_OFFSET, NAME##_SIZE);
+
+#define ROW_COMPARE_INTEGER(name, NAME) \
+    int row_compare_##name(const void* a, const void* b) { \
+        uint64_t a_value, b_value; \
+        memcpy(&a_value, a + NAME##_OFFSET, NAME##_SIZE); \
+        memcpy(&b_value, b + NAME##_OFFSET, NAME##_SIZE); \
+        return (a_value > b_value) - (a_value < b_value); \
+    }
+#define ROW_COMPARE_TEXT(name, NAME, length) \
+    int row_compare_##name(const void* a, const void* b) { \
+        return strncmp(a + NAME##_OFFSET, b + NAME##_OFFSET, NAME##_SIZE); \
+    }
+
+void serialize_row(Row* source, void* destination) {
+    ROW_TENANT_ID(SERIALIZE_INTEGER)
+    ROW_COLUMNS(SERIALIZE_INTEGER, SERIALIZE_TEXT)
+}
+
+void deserialize_row(void* source, Row* destination) {
+    ROW_TENANT_ID(DESERIALIZE_COLUMN)
+    ROW_COLUMNS(DESERIALIZE_COLUMN, DESERIALIZE_COLUMN)
+}
+
+ROW_COLUMNS(ROW_COMPARE_INTEGER, ROW_COMPARE_TEXT)
+
+void encode_key_part(uint64_t part, uint8_t* destination) {
+    for (uint32_t i = 0; i < KEY_PART_SIZE; i++) {
+        destination[i] = part >> (8*(KEY_PART_SIZE - 1 - i));
+    }
+}
+
+uint64_t decode_key_part(const uint8_t* source) {
+    uint64_t part = 0;
+    for (uint32_t i = 0; i < KEY_PART_SIZE; i++) {
+        part = (part << 8) | source[i];
+    }
+    return part;
+}
+
+void encode_key(uint64_t tenant_id, uint64_t id, void* key) {
+    encode_key_part(tenant_id, key);
+    encode_key_part(id, key + KEY_PART_SIZE);
+}
+
+uint64_t key_tenant_id(const void* key) {
+    return decode_key_part(key);
+}
+
+uint64_t key_id(const void* key) {
+    return decode_key_part(key + KEY_PART_SIZE);
+}
+
+// Keys are encoded to sort as their bytes do, so they compare with memcmp
+int compare_keys(const void* a, const void* b) {
+    return memcmp(a, b, TABLE_KEY_SIZE);
+}
+
+// The key the row is stored under
+void row_key(Row* row, void* key) {
+    encode_key(row->tenant_id, row->id, key);
+}
+
+void print_constants () {
+    printf("ROW_SIZE: %d\n", ROW_SIZE);
+    printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
+    printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
+    printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+}
+
+// What the calling thread is doing with a pager: writing to it, or reading a
+// snapshot of it
+typedef struct {
+    Pager* pager;
+    uint32_t depth; // snapshots nest, sharing the outermost one
+    uint32_t slot;
+    uint64_t version;
+} ThreadSnapshot;
+
+_Thread_local Pager* writing_pager;
+_Thread_local ThreadSnapshot reading_snapshot;
+
+void check_page_num(uint32_t page_num) {
+    if (page_num >= TABLE_MAX_PAGES) {
+        printf("Tried to fetch page numbers out of bounds. %d > %d\n", page_num, TABLE_MAX_PAGES);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Statistics. A thread's block is created the first time it counts anything
+// and linked into a list that db_stats walks. Only the owning thread writes a
+// block, so counting is a relaxed load and store with no read-modify-write;
+// readers may see a count a moment stale but never a torn one. The blocks of
+// threads that exit are folded into retired_stats.
+typedef struct ThreadStats {
+    DbStats stats;
+    struct ThreadStats* next;
+} ThreadStats;
+
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+pthread_key_t stats_key;
+ThreadStats* all_thread_stats;
+DbStats retired_stats;
+_Thread_local ThreadStats* thread_stats;
+
+void stats_add(uint64_t* counter, uint64_t amount) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+// Adds every counter and bucket of one block into another, and takes the
+// larger of their maximums
+void stats_accumulate(DbStats* total, DbStats* stats) {
+    uint64_t max_ns[NUM_TIMERS];
+    for (uint32_t timer = 0; timer < NUM_TIMERS; timer++) {
+        max_ns[timer] = total->latencies[timer].max_ns;
+    }
+    uint64_t* source = (uint64_t*)stats;
+    uint64_t* destination = (uint64_t*)total;
+    for (size_t i = 0; i < sizeof(DbStats)/sizeof(uint64_t); i++) {
+        destination[i] += __atomic_load_n(&(source[i]), __ATOMIC_RELAXED);
+    }
+    for (uint32_t timer = 0; timer < NUM_TIMERS; timer++) {
+        uint64_t other = __atomic_load_n(&(stats->latencies[timer].max_ns), __ATOMIC_RELAXED);
+        total->latencies[timer].max_ns = other > max_ns[timer] ? other : max_ns[timer];
+    }
+}
+
+void thread_stats_exit(void* arg) {
+    ThreadStats* block = arg;
+    pthread_mutex_lock(&stats_lock);
+    stats_accumulate(&retired_stats, &(block->stats));
+    ThreadStats** link = &all_thread_stats;
+    while (*link != block) {
+        link = &((*link)->next);
+    }
+    *link = block->next;
+    pthread_mutex_unlock(&stats_lock);
+    free(block);
+}
+
+void stats_create_key() {
+    pthread_key_create(&stats_key, thread_stats_exit);
+}
+
+DbStats* current_stats() {
+    if (thread_stats == NULL) {
+        pthread_once(&stats_key_once, stats_create_key);
+        ThreadStats* block = calloc(1, sizeof(ThreadStats));
+        pthread_mutex_lock(&stats_lock);
+        block->next = all_thread_stats;
+        all_thread_stats = block;
+        pthread_mutex_unlock(&stats_lock);
+        pthread_setspecific(stats_key, block);
+        thread_stats = block;
+    }
+    return &(thread_stats->stats);
+}
+
+uint64_t stats_clock_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec*1000000000 + now.tv_nsec;
+}
+
+// Values below LATENCY_SUB_BUCKETS get a bucket each. Above that, the bucket
+// is picked by the value's highest set bit and the bits just below it.
+uint32_t latency_bucket(uint64_t value) {
+    if (value < LATENCY_SUB_BUCKETS) {
+        return value;
+    }
+    uint32_t exponent = 63 - __builtin_clzll(value);
+    uint32_t shift = exponent - LATENCY_SUB_BUCKET_BITS;
+    return (shift + 1)*LATENCY_SUB_BUCKETS + (uint32_t)((value >> shift) - LATENCY_SUB_BUCKETS);
+}
+
+// The smallest value that falls in the bucket
+uint64_t latency_bucket_value(uint32_t bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+    uint32_t shift = bucket/LATENCY_SUB_BUCKETS - 1;
+    return (uint64_t)(LATENCY_SUB_BUCKETS + bucket%LATENCY_SUB_BUCKETS) << shift;
+}
+
+void stats_record_latency(StatsTimer timer, uint64_t start_ns) {
+    uint64_t elapsed = stats_clock_ns() - start_ns;
+    LatencyHistogram* histogram = &(current_stats()->latencies[timer]);
+    stats_add(&(histogram->count), 1);
+    stats_add(&(histogram->total_ns), elapsed);
+    stats_add(&(histogram->buckets[latency_bucket(elapsed)]), 1);
+    if (elapsed > histogram->max_ns) {
+        __atomic_store_n(&(histogram->max_ns), elapsed, __ATOMIC_RELAXED);
+    }
+}
+
+// Sums the counts of every thread, those that have exited included
+void db_stats(DbStats* stats) {
+    pthread_mutex_lock(&stats_lock);
+    *stats = retired_stats;
+    for (ThreadStats* block = all_thread_stats; block != NULL; block = block->next) {
+        stats_accumulate(stats, &(block->stats));
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+// Other threads may be counting as their blocks are cleared, in which case
+// they keep what they count from then on
+void db_reset_stats() {
+    pthread_mutex_lock(&stats_lock);
+    memset(&retired_stats, 0, sizeof(retired_stats));
+    for (ThreadStats* block = all_thread_stats; block != NULL; block = block->next) {
+        uint64_t* counters = (uint64_t*)&(block->stats);
+        for (size_t i = 0; i < sizeof(DbStats)/sizeof(uint64_t); i++) {
+            __atomic_store_n(&(counters[i]), 0, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+// The value below which the given fraction of the recorded latencies fall
+uint64_t latency_percentile(LatencyHistogram* histogram, double percentile) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(percentile*histogram->count);
+    if (rank >= histogram->count) {
+        rank = histogram->count - 1;
+    }
+    uint64_t seen = 0;
+    for (uint32_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += histogram->buckets[bucket];
+        if (seen > rank) {
+            return latency_bucket_value(bucket);
+        }
+    }
+    return histogram->max_ns;
+}
+
+const char* timer_names[NUM_TIMERS] = {"prepare", "execute", "flush"};
+
+void print_stats(DbStats* stats) {
+    uint64_t lookups = stats->page_hits + stats->page_misses;
+    printf("Pages: %llu hits, %llu misses (%.1f%% hit), %llu read ahead\n",
+           (unsigned long long)stats->page_hits, (unsigned long long)stats->page_misses,
+           lookups > 0 ? 100.0*stats->page_hits/lookups : 0.0,
+           (unsigned long long)stats->pages_read_ahead);
+    printf("I/O: %llu bytes read, %llu bytes written\n",
+           (unsigned long long)stats->bytes_read, (unsigned long long)stats->bytes_written);
+    for (uint32_t timer = 0; timer < NUM_TIMERS; timer++) {
+        LatencyHistogram* histogram = &(stats->latencies[timer]);
+        printf("%s: %llu, mean %llu ns, p50 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\n",
+               timer_names[timer], (unsigned long long)histogram->count,
+               (unsigned long long)(histogram->count > 0 ? histogram->total_ns/histogram->count : 0),
+               (unsigned long long)latency_percentile(histogram, 0.50),
+               (unsigned long long)latency_percentile(histogram, 0.99),
+               (unsigned long long)latency_percentile(histogram, 0.999),
+               (unsigned long long)histogram->max_ns);
+    }
+}
+
+void write_stats(FILE* file, DbStats* stats) {
+    fprintf(file, "page_hits %llu\n", (unsigned long long)stats->page_hits);
+    fprintf(file, "page_misses %llu\n", (unsigned long long)stats->page_misses);
+    fprintf(file, "pages_read_ahead %llu\n", (unsigned long long)stats->pages_read_ahead);
+    fprintf(file, "bytes_read %llu\n", (unsigned long long)stats->bytes_read);
+    fprintf(file, "bytes_written %llu\n", (unsigned long long)stats->bytes_written);
+    for (uint32_t timer = 0; timer < NUM_TIMERS; timer++) {
+        LatencyHistogram* histogram = &(stats->latencies[timer]);
+        const char* name = timer_names[timer];
+        fprintf(file, "%s_count %llu\n", name, (unsigned long long)histogram->count);
+        fprintf(file, "%s_total_ns %llu\n", name, (unsigned long long)histogram->total_ns);
+        fprintf(file, "%s_p50_ns %llu\n", name, (unsigned long long)latency_percentile(histogram, 0.50));
+        fprintf(file, "%s_p90_ns %llu\n", name, (unsigned long long)latency_percentile(histogram, 0.90));
+        fprintf(file, "%s_p99_ns %llu\n", name, (unsigned long long)latency_percentile(histogram, 0.99));
+        fprintf(file, "%s_p999_ns %llu\n", name, (unsigned long long)latency_percentile(histogram, 0.999));
+        fprintf(file, "%s_max_ns %llu\n", name, (unsigned long long)histogram->max_ns);
+    }
+}
+
+// Batched I/O. With io_uring a batch of reads or writes goes to the kernel as
+// one submission, waiting once for all of them to complete, where pread and
+// pwrite take a system call each. The ring is shared by the threads flushing
+// and reading ahead, so batches take turns under its lock. Each transfer is an
+// extent of the file, a whole page unless the file is compressed.
+typedef struct {
+    uint64_t offset;
+    uint32_t length;
+    void* buffer;
+} IoExtent;
+
+#ifdef DB_IO_URING
+#define IO_RING_ENTRIES 64
+
+struct IoRing {
+    int fd;
+    pthread_mutex_t lock;
+    unsigned entries;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+// Returns NULL if the kernel does not allow io_uring
+IoRing* io_ring_open() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, IO_RING_ENTRIES, &params);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    IoRing* ring = malloc(sizeof(IoRing));
+    ring->fd = fd;
+    ring->entries = params.sq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries*sizeof(struct io_uring_sqe);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        printf("Unable to map the io_uring rings: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    ring->sq_tail = ring->sq_ring + params.sq_off.tail;
+    ring->sq_mask = ring->sq_ring + params.sq_off.ring_mask;
+    ring->sq_array = ring->sq_ring + params.sq_off.array;
+    ring->cq_head = ring->cq_ring + params.cq_off.head;
+    ring->cq_tail = ring->cq_ring + params.cq_off.tail;
+    ring->cq_mask = ring->cq_ring + params.cq_off.ring_mask;
+    ring->cqes = ring->cq_ring + params.cq_off.cqes;
+    pthread_mutex_init(&(ring->lock), NULL);
+    return ring;
+}
+
+void io_ring_close(IoRing* ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    pthread_mutex_destroy(&(ring->lock));
+    free(ring);
+}
+
+// Submits up to a ring's worth of reads or writes and waits for them all.
+// Returns the first error, negated, or else how many moved fewer bytes than
+// their extent.
+int io_ring_run(IoRing* ring, int file_descriptor, uint8_t opcode, IoExtent* extents, uint32_t count) {
+    unsigned tail = *(ring->sq_tail);
+    for (uint32_t i = 0; i < count; i++) {
+        unsigned index = tail & *(ring->sq_mask);
+        struct io_uring_sqe* sqe = &(ring->sqes[index]);
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = file_descriptor;
+        sqe->addr = (uint64_t)(uintptr_t)extents[i].buffer;
+        sqe->len = extents[i].length;
+        sqe->off = extents[i].offset;
+        sqe->user_data = i;
+        ring->sq_array[index] = index;
+        tail++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    int result = 0;
+    uint32_t to_submit = count;
+    uint32_t completed = 0;
+    while (completed < count) {
+        int submitted = syscall(__NR_io_uring_enter, ring->fd, to_submit, count - completed,
+                                IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        to_submit -= submitted;
+
+        unsigned head = *(ring->cq_head);
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &(ring->cqes[head & *(ring->cq_mask)]);
+            if (cqe->res < 0) {
+                if (result >= 0) {
+                    result = cqe->res;
+                }
+            } else if ((uint32_t)cqe->res < extents[cqe->user_data].length && result >= 0) {
+                result++;
+            }
+            head++;
+            completed++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return result;
+}
+#endif
+
+// Reads the extents into their buffers. Reads past the end of the file leave
+// the buffer as it was.
+void pager_read_extents(Pager* pager, IoExtent* extents, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        stats_add(&(current_stats()->bytes_read), extents[i].length);
+    }
+#ifdef DB_IO_URING
+    if (pager->io_ring != NULL) {
+        IoRing* ring = pager->io_ring;
+        pthread_mutex_lock(&(ring->lock));
+        for (uint32_t i = 0; i < count; i += ring->entries) {
+            uint32_t batch = count - i < ring->entries ? count - i : ring->entries;
+            int result = io_ring_run(ring, pager->file_descriptor, IORING_OP_READ, extents + i, batch);
+            if (result < 0) {
+                printf("Error reading file: %d\n", -result);
+                exit(EXIT_FAILURE);
+            }
+        }
+        pthread_mutex_unlock(&(ring->lock));
+        return;
+    }
+#endif
+    for (uint32_t i = 0; i < count; i++) {
+        if (pread(pager->file_descriptor, extents[i].buffer, extents[i].length, (off_t)extents[i].offset) == -1) {
+            printf("Error reading file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void pager_write_extents(Pager* pager, IoExtent* extents, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        stats_add(&(current_stats()->bytes_written), extents[i].length);
+    }
+#ifdef DB_IO_URING
+    if (pager->io_ring != NULL) {
+        IoRing* ring = pager->io_ring;
+        pthread_mutex_lock(&(ring->lock));
+        for (uint32_t i = 0; i < count; i += ring->entries) {
+            uint32_t batch = count - i < ring->entries ? count - i : ring->entries;
+            int result = io_ring_run(ring, pager->file_descriptor, IORING_OP_WRITE, extents + i, batch);
+            if (result != 0) {
+                printf("Error writting: %d\n", result < 0 ? -result : EIO);
+                exit(EXIT_FAILURE);
+            }
+        }
+        pthread_mutex_unlock(&(ring->lock));
+        return;
+    }
+#endif
+    for (uint32_t i = 0; i < count; i++) {
+        if (pwrite(pager->file_descriptor, extents[i].buffer, extents[i].length, (off_t)extents[i].offset) == -1) {
+            printf("Error writting: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Slabs hand out fixed size objects from chunks allocated a few at a time.
+// Freed objects go on a list threaded through their first bytes and are
+// reused before the current chunk is carved any further, so once a slab has
+// grown to its working size, allocating is a pop from that list. Chunks are
+// only given back when the slab is closed.
+//
+// Page slabs use chunks of one huge page, aligned to it and advised as such,
+// so scans over the cache take few TLB misses. A file's 100 pages fit in one
+// chunk, with room for some older versions, so at these sizes there are few
+// misses to save. Every page in them is aligned to the page size, as O_DIRECT
+// requires of the buffers it reads and writes.
+#define SLAB_HUGE_CHUNK_SIZE (1 << 21)
+#define SLAB_SMALL_CHUNK_SIZE (1 << 16)
+
+typedef struct SlabChunk {
+    void* memory;
+    struct SlabChunk* next;
+} SlabChunk;
+
+struct Slab {
+    size_t object_size;
+    size_t chunk_size;
+    pthread_mutex_t lock;
+    void* free_list;
+    uint8_t* next_object; // the uncarved rest of the newest chunk
+    uint8_t* chunk_end;
+    SlabChunk* chunks;
+};
+
+Slab* slab_open(size_t object_size, size_t chunk_size) {
+    Slab* slab = malloc(sizeof(Slab));
+    slab->object_size = object_size;
+    slab->chunk_size = chunk_size;
+    pthread_mutex_init(&(slab->lock), NULL);
+    slab->free_list = NULL;
+    slab->next_object = NULL;
+    slab->chunk_end = NULL;
+    slab->chunks = NULL;
+    return slab;
+}
+
+// Chunks are aligned to their size
+void slab_add_chunk(Slab* slab) {
+#ifdef _WIN32
+    void* memory = _aligned_malloc(slab->chunk_size, slab->chunk_size);
+#else
+    void* memory;
+    if (posix_memalign(&memory, slab->chunk_size, slab->chunk_size) != 0) {
+        memory = NULL;
+    }
+#endif
+    if (memory == NULL) {
+        printf("Unable to allocate memory for pages.\n");
+        exit(EXIT_FAILURE);
+    }
+#ifdef MADV_HUGEPAGE
+    if (slab->chunk_size >= SLAB_HUGE_CHUNK_SIZE) {
+        madvise(memory, slab->chunk_size, MADV_HUGEPAGE);
+    }
+#endif
+
+    SlabChunk* chunk = malloc(sizeof(SlabChunk));
+    chunk->memory = memory;
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+    slab->next_object = memory;
+    slab->chunk_end = slab->next_object + slab->chunk_size;
+}
+
+void* slab_allocate(Slab* slab) {
+    pthread_mutex_lock(&(slab->lock));
+    void* object = slab->free_list;
+    if (object != NULL) {
+        slab->free_list = *(void**)object;
+    } else {
+        if (slab->next_object == NULL || slab->next_object + slab->object_size > slab->chunk_end) {
+            slab_add_chunk(slab);
+        }
+        object = slab->next_object;
+        slab->next_object += slab->object_size;
+    }
+    pthread_mutex_unlock(&(slab->lock));
+    return object;
+}
+
+void slab_free(Slab* slab, void* object) {
+    pthread_mutex_lock(&(slab->lock));
+    *(void**)object = slab->free_list;
+    slab->free_list = object;
+    pthread_mutex_unlock(&(slab->lock));
+}
+
+void slab_close(Slab* slab) {
+    while (slab->chunks != NULL) {
+        SlabChunk* chunk = slab->chunks;
+        slab->chunks = chunk->next;
+#ifdef _WIN32
+        _aligned_free(chunk->memory);
+#else
+        free(chunk->memory);
+#endif
+        free(chunk);
+    }
+    pthread_mutex_destroy(&(slab->lock));
+    free(slab);
+}
+
+// Page compression. Rows pad their text columns with zeros to full width, so
+// most of a page is runs of zeros and the rest repeats itself from row to row.
+// Pages are compressed with LZ77, in sequences much like LZ4's: a token whose
+// high nibble counts the literals that follow and whose low nibble counts the
+// bytes to copy from earlier in the page, less PAGE_LZ_MIN_MATCH, then the
+// literals and the two byte distance back to copy from. A nibble of 15 is
+// continued by bytes added to it, up to the first that is not 255. The last
+// sequence has literals only.
+#define PAGE_LZ_MIN_MATCH 4
+#define PAGE_LZ_HASH_BITS 12
+
+// Writes a count continuing a nibble of 15
+void page_lz_put_length(uint8_t* out, uint32_t* out_length, uint32_t length) {
+    while (length >= 255) {
+        out[(*out_length)++] = 255;
+        length -= 255;
+    }
+    out[(*out_length)++] = length;
+}
+
+bool page_lz_get_length(const uint8_t* in, uint32_t in_length, uint32_t* in_pos, uint32_t* length) {
+    uint8_t byte;
+    do {
+        if (*in_pos == in_length) {
+            return false;
+        }
+        byte = in[(*in_pos)++];
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Appends a sequence, without a match if match_length is 0. Returns false if it
+// would take the output past its capacity.
+bool page_lz_put_sequence(uint8_t* out, uint32_t* out_length, uint32_t capacity, const uint8_t* literals,
+                          uint32_t num_literals, uint32_t distance, uint32_t match_length) {
+    if (*out_length + 1 + num_literals + num_literals/255 + 1 + 2 + match_length/255 + 1 > capacity) {
+        return false;
+    }
+    uint32_t literal_nibble = num_literals < 15 ? num_literals : 15;
+    uint32_t match_nibble = 0;
+    if (match_length > 0) {
+        match_nibble = match_length - PAGE_LZ_MIN_MATCH < 15 ? match_length - PAGE_LZ_MIN_MATCH : 15;
+    }
+    out[(*out_length)++] = literal_nibble << 4 | match_nibble;
+    if (literal_nibble == 15) {
+        page_lz_put_length(out, out_length, num_literals - 15);
+    }
+    memcpy(out + *out_length, literals, num_literals);
+    *out_length += num_literals;
+    if (match_length > 0) {
+        out[(*out_length)++] = distance & 0xff;
+        out[(*out_length)++] = distance >> 8;
+        if (match_nibble == 15) {
+            page_lz_put_length(out, out_length, match_length - PAGE_LZ_MIN_MATCH - 15);
+        }
+    }
+    return true;
+}
+
+// Compresses a page into at most capacity bytes. Returns the compressed
+// length, or 0 if it does not fit. Matches are found greedily through a table
+// of where each hash of four bytes was last seen.
+uint32_t page_compress(const uint8_t* page, uint8_t* out, uint32_t capacity) {
+    uint16_t last_seen[1 << PAGE_LZ_HASH_BITS]; // position + 1, or 0 if not seen
+    memset(last_seen, 0, sizeof(last_seen));
+    uint32_t out_length = 0;
+    uint32_t anchor = 0; // the first byte not yet written
+    uint32_t pos = 0;
+    while (pos + PAGE_LZ_MIN_MATCH <= PAGE_SIZE) {
+        uint32_t sequence;
+        memcpy(&sequence, page + pos, sizeof(sequence));
+        uint32_t hash = (sequence*2654435761u) >> (32 - PAGE_LZ_HASH_BITS);
+        uint32_t candidate = last_seen[hash];
+        last_seen[hash] = pos + 1;
+        if (candidate == 0 || memcmp(page + candidate - 1, page + pos, PAGE_LZ_MIN_MATCH) != 0) {
+            pos++;
+            continue;
+        }
+        candidate--;
+        uint32_t match_length = PAGE_LZ_MIN_MATCH;
+        while (pos + match_length < PAGE_SIZE && page[candidate + match_length] == page[pos + match_length]) {
+            match_length++;
+        }
+        if (!page_lz_put_sequence(out, &out_length, capacity, page + anchor, pos - anchor,
+                                  pos - candidate, match_length)) {
+            return 0;
+        }
+        pos += match_length;
+        anchor = pos;
+    }
+    if (!page_lz_put_sequence(out, &out_length, capacity, page + anchor, PAGE_SIZE - anchor, 0, 0)) {
+        return 0;
+    }
+    return out_length;
+}
+
+// Returns false unless the input decompresses to exactly a page
+bool page_decompress(const uint8_t* in, uint32_t in_length, uint8_t* page) {
+    uint32_t in_pos = 0;
+    uint32_t pos = 0;
+    while (in_pos < in_length) {
+        uint8_t token = in[in_pos++];
+        uint32_t num_literals = token >> 4;
+        if (num_literals == 15 && !page_lz_get_length(in, in_length, &in_pos, &num_literals)) {
+            return false;
+        }
+        if (num_literals > in_length - in_pos || num_literals > PAGE_SIZE - pos) {
+            return false;
+        }
+        memcpy(page + pos, in + in_pos, num_literals);
+        in_pos += num_literals;
+        pos += num_literals;
+        if (in_pos == in_length) {
+            break;
+        }
+
+        if (in_length - in_pos < 2) {
+            return false;
+        }
+        uint32_t distance = in[in_pos] | in[in_pos + 1] << 8;
+        in_pos += 2;
+        uint32_t match_length = token & 15;
+        if (match_length == 15 && !page_lz_get_length(in, in_length, &in_pos, &match_length)) {
+            return false;
+        }
+        match_length += PAGE_LZ_MIN_MATCH;
+        if (distance == 0 || distance > pos || match_length > PAGE_SIZE - pos) {
+            return false;
+        }
+        if (distance == 1) {
+            memset(page + pos, page[pos - 1], match_length);
+        } else if (distance >= match_length) {
+            memcpy(page + pos, page + pos - distance, match_length);
+        } else {
+            for (uint32_t i = 0; i < match_length; i++) {
+                page[pos + i] = page[pos - distance + i];
+            }
+        }
+        pos += match_length;
+    }
+    return pos == PAGE_SIZE;
+}
+
+// A compressed file starts with a page map, a page giving the slot each page
+// is stored in, and the slots follow it. Slots come in sizes from
+// PAGE_SLOT_MIN_SIZE up to a whole page, doubling, and a page goes in the
+// smallest that holds it compressed. Pages that do not fit in half a page
+// compressed are stored as they are in a whole page slot. Every slot is
+// aligned to PAGE_SLOT_MIN_SIZE, and is read and written whole, so direct I/O
+// works as it does for uncompressed files.
+//
+// A page is never written over in its slot. Each write puts it in a free slot,
+// split down to the size it needs, or in one at the end of the file, and the slot it moved
+// out of is only reused once the map pointing elsewhere is on the disk: a
+// flush writes the pages, waits for them to reach the disk, writes the map and
+// waits for that too. A crash part way through leaves the map of the last
+// flush pointing at the pages it wrote, as long as the map page itself, a
+// single page, is written whole. The slots no page is in are found again when
+// the file is opened.
+#define PAGE_MAP_MAGIC 0x7a5f4443 // "CD_z"
+#define PAGE_SLOT_MIN_SIZE 512
+#define PAGE_SLOT_SIZES 4 // 512 to 4096 bytes
+// A page's new slot and the one it left can both be taken until the map is
+// written, so each size can have twice as many slots as there are pages
+#define PAGE_MAP_MAX_FREE_SLOTS (2*TABLE_MAX_PAGES)
+
+typedef struct {
+    uint32_t offset;
+    uint16_t length; // compressed, PAGE_SIZE if not compressed, or 0 if not in the file
+    uint16_t capacity;
+} PageSlot;
+
+enum {
+    PAGE_MAP_MAGIC_SIZE = sizeof(uint32_t),
+    PAGE_MAP_MAGIC_OFFSET = 0,
+    PAGE_MAP_SLOTS_SIZE = sizeof(PageSlot)*TABLE_MAX_PAGES,
+    PAGE_MAP_SLOTS_OFFSET = sizeof(uint64_t),
+};
+_Static_assert(PAGE_MAP_SLOTS_OFFSET + PAGE_MAP_SLOTS_SIZE <= PAGE_SIZE, "the page map must fit in a page");
+
+struct PageMap {
+    pthread_mutex_t lock;
+    PageSlot slots[TABLE_MAX_PAGES];
+    uint32_t file_end;
+    uint32_t free_slots[PAGE_SLOT_SIZES][PAGE_MAP_MAX_FREE_SLOTS]; // offsets, by size
+    uint32_t num_free_slots[PAGE_SLOT_SIZES];
+    // Slots moved out of since the map was last written, not yet free
+    uint32_t left_slots[TABLE_MAX_PAGES];
+    uint16_t left_capacities[TABLE_MAX_PAGES];
+    uint32_t num_left_slots;
+};
+
+uint32_t page_slot_size_class(uint32_t length) {
+    uint32_t size_class = 0;
+    while ((PAGE_SLOT_MIN_SIZE << size_class) < length) {
+        size_class++;
+    }
+    return size_class;
+}
+
+// Frees a slot for pages to move into. A slot with no room left on its free
+// list is lost to the file.
+void page_map_free_slot(PageMap* map, uint32_t offset, uint32_t capacity) {
+    uint32_t size_class = page_slot_size_class(capacity);
+    if (map->num_free_slots[size_class] < PAGE_MAP_MAX_FREE_SLOTS) {
+        map->free_slots[size_class][map->num_free_slots[size_class]++] = offset;
+    }
+}
+
+int compare_page_slots(const void* a, const void* b) {
+    uint32_t offset_a = ((const PageSlot*)a)->offset;
+    uint32_t offset_b = ((const PageSlot*)b)->offset;
+    return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+// Frees the space between the slots pages are in, split into the largest
+// slots that fit it
+void page_map_find_free_slots(PageMap* map) {
+    PageSlot used[TABLE_MAX_PAGES];
+    uint32_t num_used = 0;
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+        if (map->slots[i].length != 0) {
+            used[num_used++] = map->slots[i];
+        }
+    }
+    qsort(used, num_used, sizeof(PageSlot), compare_page_slots);
+
+    uint32_t offset = PAGE_SIZE;
+    for (uint32_t i = 0; i <= num_used; i++) {
+        uint32_t gap_end = i < num_used ? used[i].offset : map->file_end;
+        while (offset + PAGE_SLOT_MIN_SIZE <= gap_end) {
+            uint32_t size_class = PAGE_SLOT_SIZES - 1;
+            while (offset + (PAGE_SLOT_MIN_SIZE << size_class) > gap_end) {
+                size_class--;
+            }
+            page_map_free_slot(map, offset, PAGE_SLOT_MIN_SIZE << size_class);
+            offset += PAGE_SLOT_MIN_SIZE << size_class;
+        }
+        if (i < num_used && used[i].offset + used[i].capacity > offset) {
+            offset = used[i].offset + used[i].capacity;
+        }
+    }
+}
+
+// Sets up the map of a new file, or of one whose first page was read into the
+// buffer given
+PageMap* page_map_open(void* first_page) {
+    PageMap* map = malloc(sizeof(PageMap));
+    pthread_mutex_init(&(map->lock), NULL);
+    map->file_end = PAGE_SIZE;
+    for (uint32_t i = 0; i < PAGE_SLOT_SIZES; i++) {
+        map->num_free_slots[i] = 0;
+    }
+    map->num_left_slots = 0;
+    if (first_page == NULL) {
+        memset(map->slots, 0, PAGE_MAP_SLOTS_SIZE);
+        return map;
+    }
+
+    memcpy(map->slots, first_page + PAGE_MAP_SLOTS_OFFSET, PAGE_MAP_SLOTS_SIZE);
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+        PageSlot* slot = &(map->slots[i]);
+        if (slot->length == 0) {
+            continue;
+        }
+        if (slot->length > slot->capacity || slot->capacity > PAGE_SIZE || slot->offset % PAGE_SLOT_MIN_SIZE != 0) {
+            printf("Page map has a bad slot for page %d. Corrupt file.\n", i);
+            exit(EXIT_FAILURE);
+        }
+        if (slot->offset + slot->capacity > map->file_end) {
+            map->file_end = slot->offset + slot->capacity;
+        }
+    }
+    page_map_find_free_slots(map);
+    return map;
+}
+
+void page_map_close(PageMap* map) {
+    pthread_mutex_destroy(&(map->lock));
+    free(map);
+}
+
+// The number of pages the file holds
+uint32_t page_map_num_pages(PageMap* map) {
+    uint32_t num_pages = 0;
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+        if (map->slots[i].length != 0) {
+            num_pages = i + 1;
+        }
+    }
+    return num_pages;
+}
+
+// Moves a page of the length given to a new slot. The slot it leaves stays
+// taken until the map is written. Called holding the map lock.
+PageSlot* page_map_place(PageMap* map, uint32_t page_num, uint32_t length) {
+    PageSlot* slot = &(map->slots[page_num]);
+    if (slot->length != 0) {
+        map->left_slots[map->num_left_slots] = slot->offset;
+        map->left_capacities[map->num_left_slots] = slot->capacity;
+        map->num_left_slots++;
+    }
+
+    // The smallest free slot that holds the page, halved until it fits it,
+    // with the halves not taken freed
+    uint32_t size_class = page_slot_size_class(length);
+    uint32_t free_class = size_class;
+    while (free_class < PAGE_SLOT_SIZES && map->num_free_slots[free_class] == 0) {
+        free_class++;
+    }
+    if (free_class < PAGE_SLOT_SIZES) {
+        slot->offset = map->free_slots[free_class][--map->num_free_slots[free_class]];
+        while (free_class > size_class) {
+            free_class--;
+            page_map_free_slot(map, slot->offset + (PAGE_SLOT_MIN_SIZE << free_class), PAGE_SLOT_MIN_SIZE << free_class);
+        }
+    } else {
+        slot->offset = map->file_end;
+        map->file_end += PAGE_SLOT_MIN_SIZE << size_class;
+    }
+    slot->length = length;
+    slot->capacity = PAGE_SLOT_MIN_SIZE << size_class;
+    return slot;
+}
+
+// Reads the pages into the buffers given, decompressing them from their slots
+// if the file is compressed. Pages not in the file leave the buffer as it was.
+void pager_read_pages(Pager* pager, uint32_t* page_nums, void** pages, uint32_t count) {
+    IoExtent extents[TABLE_MAX_PAGES];
+    PageMap* map = pager->page_map;
+    if (map == NULL) {
+        for (uint32_t i = 0; i < count; i++) {
+            extents[i].offset = (uint64_t)page_nums[i]*PAGE_SIZE;
+            extents[i].length = PAGE_SIZE;
+            extents[i].buffer = pages[i];
+        }
+        pager_read_extents(pager, extents, count);
+        return;
+    }
+
+    uint32_t targets[TABLE_MAX_PAGES]; // the page each extent is for
+    uint16_t lengths[TABLE_MAX_PAGES];
+    uint32_t num_extents = 0;
+    pthread_mutex_lock(&(map->lock));
+    for (uint32_t i = 0; i < count; i++) {
+        PageSlot slot = map->slots[page_nums[i]];
+        if (slot.length == 0) {
+            continue;
+        }
+        extents[num_extents].offset = slot.offset;
+        extents[num_extents].length = slot.capacity;
+        extents[num_extents].buffer = slot.length == PAGE_SIZE ? pages[i] : slab_allocate(pager->page_slab);
+        targets[num_extents] = i;
+        lengths[num_extents] = slot.length;
+        num_extents++;
+    }
+    pthread_mutex_unlock(&(map->lock));
+
+    pager_read_extents(pager, extents, num_extents);
+    for (uint32_t i = 0; i < num_extents; i++) {
+        if (lengths[i] == PAGE_SIZE) {
+            continue;
+        }
+        uint32_t page_num = page_nums[targets[i]];
+        // A page cached and moved since its slot was looked up may have been
+        // read from a slot since reused. The copy read is thrown away then.
+        if (!page_decompress(extents[i].buffer, lengths[i], pages[targets[i]]) &&
+            __atomic_load_n(&(pager->pages[page_num]), __ATOMIC_ACQUIRE) == NULL) {
+            printf("Page %d does not decompress. Corrupt file.\n", page_num);
+            exit(EXIT_FAILURE);
+        }
+        slab_free(pager->page_slab, extents[i].buffer);
+    }
+}
+
+// Waits for what has been written to the file to reach the disk
+void pager_sync(Pager* pager) {
+    if (fsync(pager->file_descriptor) == -1) {
+        printf("Error syncing the db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Writes the pages to the file. Pages of a compressed file are compressed into
+// new slots, then the page map is written.
+void pager_write_pages(Pager* pager, uint32_t* page_nums, void** pages, uint32_t count) {
+    IoExtent extents[TABLE_MAX_PAGES];
+    PageMap* map = pager->page_map;
+    if (map == NULL) {
+        for (uint32_t i = 0; i < count; i++) {
+            extents[i].offset = (uint64_t)page_nums[i]*PAGE_SIZE;
+            extents[i].length = PAGE_SIZE;
+            extents[i].buffer = pages[i];
+        }
+        pager_write_extents(pager, extents, count);
+        return;
+    }
+
+    void* compressed[TABLE_MAX_PAGES];
+    for (uint32_t i = 0; i < count; i++) {
+        compressed[i] = slab_allocate(pager->page_slab);
+        uint32_t length = page_compress(pages[i], compressed[i], PAGE_SIZE/2);
+        if (length == 0) {
+            slab_free(pager->page_slab, compressed[i]);
+            compressed[i] = NULL;
+            length = PAGE_SIZE;
+        }
+        pthread_mutex_lock(&(map->lock));
+        PageSlot* slot = page_map_place(map, page_nums[i], length);
+        extents[i].offset = slot->offset;
+        extents[i].length = slot->capacity;
+        pthread_mutex_unlock(&(map->lock));
+        if (compressed[i] != NULL) {
+            memset(compressed[i] + length, 0, extents[i].length - length);
+            extents[i].buffer = compressed[i];
+        } else {
+            extents[i].buffer = pages[i];
+        }
+    }
+    pager_write_extents(pager, extents, count);
+    pager_sync(pager);
+
+    void* map_page = slab_allocate(pager->page_slab);
+    memset(map_page, 0, PAGE_SIZE);
+    *(uint32_t*)(map_page + PAGE_MAP_MAGIC_OFFSET) = PAGE_MAP_MAGIC;
+    pthread_mutex_lock(&(map->lock));
+    memcpy(map_page + PAGE_MAP_SLOTS_OFFSET, map->slots, PAGE_MAP_SLOTS_SIZE);
+    pthread_mutex_unlock(&(map->lock));
+    IoExtent map_extent = {0, PAGE_SIZE, map_page};
+    pager_write_extents(pager, &map_extent, 1);
+    pager_sync(pager);
+
+    // Nothing on the disk points at the slots pages left any more
+    pthread_mutex_lock(&(map->lock));
+    for (uint32_t i = 0; i < map->num_left_slots; i++) {
+        page_map_free_slot(map, map->left_slots[i], map->left_capacities[i]);
+    }
+    map->num_left_slots = 0;
+    pthread_mutex_unlock(&(map->lock));
+
+    slab_free(pager->page_slab, map_page);
+    for (uint32_t i = 0; i < count; i++) {
+        if (compressed[i] != NULL) {
+            slab_free(pager->page_slab, compressed[i]);
+        }
+    }
+}
+
+// The helper thread behind read-ahead. It loads the queued pages into the
+// cache so a scan finds them there rather than waiting on each read.
+void* pager_read_ahead_worker(void* arg);
+
+// Queues the pages from first_page on for the helper and hints the kernel to
+// start reading them. Only pages already in the file are read ahead. Called
+// holding the pager lock.
+void pager_read_ahead(Pager* pager, uint32_t first_page) {
+    uint32_t file_pages = pager->file_length/PAGE_SIZE;
+    uint32_t end_page = first_page + READ_AHEAD_PAGES;
+    if (end_page > file_pages) {
+        end_page = file_pages;
+    }
+    if (first_page >= end_page) {
+        return;
+    }
+
+#ifndef _WIN32
+    // Direct reads skip the kernel's cache, so there is nothing for it to fill.
+    // Nor is there a range to give it for pages in slots.
+    if (!(pager->direct_io) && pager->page_map == NULL) {
+        posix_fadvise(pager->file_descriptor, (off_t)first_page*PAGE_SIZE,
+                      (off_t)(end_page - first_page)*PAGE_SIZE, POSIX_FADV_WILLNEED);
+    }
+#endif
+
+    if (!(pager->read_ahead_running)) {
+        if (pthread_create(&(pager->read_ahead_thread), NULL, pager_read_ahead_worker, pager) != 0) {
+            return;
+        }
+        pager->read_ahead_running = true;
+    }
+    for (uint32_t page_num = first_page; page_num < end_page; page_num++) {
+        if (pager->read_ahead_tail - pager->read_ahead_head == READ_AHEAD_QUEUE_SIZE) {
+            break;
+        }
+        if (__atomic_load_n(&(pager->pages[page_num]), __ATOMIC_ACQUIRE) == NULL) {
+            pager->read_ahead_queue[pager->read_ahead_tail % READ_AHEAD_QUEUE_SIZE] = page_num;
+            pager->read_ahead_tail += 1;
+        }
+    }
+    pthread_cond_signal(&(pager->read_ahead_ready));
+}
+
+// Publishes a page read from the file as its first version, unless another
+// thread got there first, in which case the copy is freed. Called holding the
+// pager lock.
+PageVersion* pager_publish_page(Pager* pager, uint32_t page_num, void* page) {
+    PageVersion* cached = __atomic_load_n(&(pager->pages[page_num]), __ATOMIC_ACQUIRE);
+    if (cached != NULL) {
+        slab_free(pager->page_slab, page);
+        return cached;
+    }
+    if (page_num >= pager->num_pages) {
+        pager->num_pages = page_num+1;
+    }
+
+    cached = slab_allocate(pager->version_slab);
+    cached->data = page;
+    cached->version = 0;
+    cached->older = NULL;
+    // Publish the page only once it is filled in, for readers not taking the lock
+    __atomic_store_n(&(pager->pages[page_num]), cached, __ATOMIC_RELEASE);
+    return cached;
+}
+
+// Cache miss. Loads the page from the file as its first version. The read
+// happens outside the lock, so misses on different pages overlap. A miss on
+// the page after the previous miss starts reading ahead.
+PageVersion* pager_load_page(Pager* pager, uint32_t page_num) {
+    void* page = slab_allocate(pager->page_slab);
+    uint32_t num_pages = pager->file_length/PAGE_SIZE;
+
+    //We might save a partial page at the end of the file
+    if (pager->file_length%PAGE_SIZE) {
+        num_pages += 1;
+    }
+
+    if (pager->page_map != NULL) {
+        pager_read_pages(pager, &page_num, &page, 1);
+    } else if (page_num <= num_pages) {
+        ssize_t bytes_read = pread(pager->file_descriptor, page, PAGE_SIZE, (off_t)page_num*PAGE_SIZE);
+        if (bytes_read == -1) {
+            printf("Error reading file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        stats_add(&(current_stats()->bytes_read), bytes_read);
+    }
+    stats_add(&(current_stats()->page_misses), 1);
+
+    pthread_mutex_lock(&(pager->lock));
+    PageVersion* cached = pager_publish_page(pager, page_num, page);
+    if (page_num == pager->last_miss + 1) {
+        pager_read_ahead(pager, page_num + 1);
+    }
+    pager->last_miss = page_num;
+    pthread_mutex_unlock(&(pager->lock));
+    return cached;
+}
+
+// Takes everything queued, reads the pages still not cached in one batch and
+// publishes them.
+void* pager_read_ahead_worker(void* arg) {
+    Pager* pager = arg;
+    uint32_t page_nums[READ_AHEAD_QUEUE_SIZE];
+    void* pages[READ_AHEAD_QUEUE_SIZE];
+
+    pthread_mutex_lock(&(pager->lock));
+    while (true) {
+        while (!(pager->read_ahead_closing) && pager->read_ahead_head == pager->read_ahead_tail) {
+            pthread_cond_wait(&(pager->read_ahead_ready), &(pager->lock));
+        }
+        if (pager->read_ahead_closing) {
+            break;
+        }
+        uint32_t count = 0;
+        while (pager->read_ahead_head != pager->read_ahead_tail) {
+            uint32_t page_num = pager->read_ahead_queue[pager->read_ahead_head % READ_AHEAD_QUEUE_SIZE];
+            pager->read_ahead_head += 1;
+            if (__atomic_load_n(&(pager->pages[page_num]), __ATOMIC_ACQUIRE) == NULL) {
+                page_nums[count] = page_num;
+                pages[count] = slab_allocate(pager->page_slab);
+                count++;
+            }
+        }
+        pthread_mutex_unlock(&(pager->lock));
+
+        pager_read_pages(pager, page_nums, pages, count);
+        stats_add(&(current_stats()->pages_read_ahead), count);
+
+        pthread_mutex_lock(&(pager->lock));
+        for (uint32_t i = 0; i < count; i++) {
+            pager_publish_page(pager, page_nums[i], pages[i]);
+        }
+    }
+    pthread_mutex_unlock(&(pager->lock));
+    return NULL;
+}
+
+// The writer sees its own changes. Readers see the version their snapshot
+// allows, or the newest one outside a snapshot.
+void* get_page(Pager* pager, uint32_t page_num) {
+    check_page_num(page_num);
+
+    bool writing = (writing_pager == pager);
+    if (writing && pager->uncommitted[page_num] != NULL) {
+        stats_add(&(current_stats()->page_hits), 1);
+        return pager->uncommitted[page_num];
+    }
+
+    PageVersion* version = __atomic_load_n(&(pager->pages[page_num]), __ATOMIC_ACQUIRE);
+    if (version == NULL) {
+        version = pager_load_page(pager, page_num);
+    } else {
+        stats_add(&(current_stats()->page_hits), 1);
+    }
+    if (!writing && reading_snapshot.pager == pager) {
+        while (version != NULL && version->version > reading_snapshot.version) {
+            version = version->older;
+        }
+        if (version == NULL) {
+            printf("Page %d has no version old enough for the snapshot.\n", page_num);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return version->data;
+}
+
+// Returns the writer's own copy of the page, copying the committed version the
+// first time the page is changed in a transaction. Outside a write transaction,
+// as when setting up a new file, pages are changed in place.
+void* get_page_for_write(Pager* pager, uint32_t page_num) {
+    if (writing_pager != pager) {
+        return get_page(pager, page_num);
+    }
+    check_page_num(page_num);
+
+    if (pager->uncommitted[page_num] == NULL) {
+        void* page = slab_allocate(pager->page_slab);
+        if (page_num < pager->num_pages) {
+            memcpy(page, get_page(pager, page_num), PAGE_SIZE);
+        } else {
+            // A new page, which no reader can reach until it commits
+            pthread_mutex_lock(&(pager->lock));
+            pager->num_pages = page_num+1;
+            pthread_mutex_unlock(&(pager->lock));
+        }
+        pager->uncommitted[page_num] = page;
+    }
+    return pager->uncommitted[page_num];
+}
+
+void free_page_versions(Pager* pager, PageVersion* version) {
+    while (version != NULL) {
+        PageVersion* older = version->older;
+        slab_free(pager->page_slab, version->data);
+        slab_free(pager->version_slab, version);
+        version = older;
+    }
+}
+
+void pager_begin_write(Pager* pager) {
+    writing_pager = pager;
+}
+
+// Frees the versions of each page that no open snapshot can read: everything
+// older than the newest version at or before the oldest snapshot. Readers
+// stop walking at that version, so they never reach what is freed.
+void pager_collect_garbage(Pager* pager) {
+    pthread_mutex_lock(&(pager->snapshot_lock));
+    uint64_t oldest = pager->committed_version;
+    for (uint32_t i = 0; i < PAGER_MAX_SNAPSHOTS; i++) {
+        if (pager->snapshot_open[i] && pager->snapshot_versions[i] < oldest) {
+            oldest = pager->snapshot_versions[i];
+        }
+    }
+    pthread_mutex_unlock(&(pager->snapshot_lock));
+
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+        PageVersion* version = __atomic_load_n(&(pager->pages[i]), __ATOMIC_ACQUIRE);
+        while (version != NULL && version->version > oldest) {
+            version = version->older;
+        }
+        if (version != NULL && version->older != NULL) {
+            free_page_versions(pager, version->older);
+            version->older = NULL;
+        }
+    }
+}
+
+// Publishes the writer's copies as the newest version of each page it changed.
+// The commit is only visible to snapshots begun after committed_version moves
+// on, so they see all of its pages or none.
+void pager_commit_write(Pager* pager) {
+    uint64_t version = pager->committed_version + 1;
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+        if (pager->uncommitted[i] == NULL) {
+            continue;
+        }
+        PageVersion* page_version = slab_allocate(pager->version_slab);
+        page_version->data = pager->uncommitted[i];
+        page_version->version = version;
+        page_version->older = __atomic_load_n(&(pager->pages[i]), __ATOMIC_ACQUIRE);
+        __atomic_store_n(&(pager->pages[i]), page_version, __ATOMIC_RELEASE);
+        pager->uncommitted[i] = NULL;
+    }
+    __atomic_store_n(&(pager->committed_version), version, __ATOMIC_RELEASE);
+    writing_pager = NULL;
+
+    pager_collect_garbage(pager);
+}
+
+void pager_begin_snapshot(Pager* pager) {
+    if (reading_snapshot.depth > 0) {
+        if (reading_snapshot.pager != pager) {
+            printf("Tried to read two databases at once from one thread.\n");
+            exit(EXIT_FAILURE);
+        }
+        reading_snapshot.depth += 1;
+        return;
+    }
+
+    pthread_mutex_lock(&(pager->snapshot_lock));
+    uint32_t slot = 0;
+    while (slot < PAGER_MAX_SNAPSHOTS && pager->snapshot_open[slot]) {
+        slot++;
+    }
+    if (slot == PAGER_MAX_SNAPSHOTS) {
+        printf("Too many snapshots open at once.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t version = __atomic_load_n(&(pager->committed_version), __ATOMIC_ACQUIRE);
+    pager->snapshot_open[slot] = true;
+    pager->snapshot_versions[slot] = version;
+    pthread_mutex_unlock(&(pager->snapshot_lock));
+
+    reading_snapshot.pager = pager;
+    reading_snapshot.depth = 1;
+    reading_snapshot.slot = slot;
+    reading_snapshot.version = version;
+}
+
+void pager_end_snapshot(Pager* pager) {
+    reading_snapshot.depth -= 1;
+    if (reading_snapshot.depth > 0) {
+        return;
+    }
+    pthread_mutex_lock(&(pager->snapshot_lock));
+    pager->snapshot_open[reading_snapshot.slot] = false;
+    pthread_mutex_unlock(&(pager->snapshot_lock));
+    reading_snapshot.pager = NULL;
+}
+
+// Takes a page for a new node: the one freed last if there are any free, and
+// otherwise the next at the end of the file. Must be called inside a write,
+// and the page then written.
+uint32_t get_unused_page_num(Pager* pager) {
+    uint32_t num_free = *header_num_free_pages(get_page(pager, DB_HEADER_PAGE_NUM));
+    if (num_free == 0) {
+        return pager->num_pages;
+    }
+    void* header = get_page_for_write(pager, DB_HEADER_PAGE_NUM);
+    *header_num_free_pages(header) = num_free - 1;
+    return *header_free_page(header, num_free - 1);
+}
+
+// Adds the page to the free list. Readers in snapshots from before the write
+// still read what it held. Must be called inside a write.
+void free_page(Pager* pager, uint32_t page_num) {
+    void* header = get_page_for_write(pager, DB_HEADER_PAGE_NUM);
+    uint32_t num_free = *header_num_free_pages(header);
+    *header_free_page(header, num_free) = page_num;
+    *header_num_free_pages(header) = num_free + 1;
+}
+
+// The pages new nodes can still take, free ones and those the file can grow by
+uint32_t pager_pages_available(Pager* pager) {
+    return TABLE_MAX_PAGES - pager->num_pages + *header_num_free_pages(get_page(pager, DB_HEADER_PAGE_NUM));
+}
+
+// The table is a B-tree keyed by row id, holding the rows in its leaves. As in
+// the indexes, internal node key i is the largest key in child i, and splits
+// walk back up the path recorded on the way down. The root stays on the same
+// page: when it splits, its cells move to two new children.
+//
+// Internal nodes count the rows under each child. An insert adds one to the
+// counts along its path, and a split sets the counts of the nodes it lays out
+// from their contents, so a row can be found by its position as well as its
+// key.
+//
+// Ids mostly arrive in increasing order, so the table remembers the path to
+// its rightmost leaf. A key larger than every other is appended there without
+// descending from the root, and when an append splits a node, the node keeps
+// nine tenths of its cells rather than half, so sequentially filled leaves end
+// up nearly full instead of half empty.
+
+// A root-to-leaf path through a tree: the internal nodes descended through and
+// the child taken in each
+typedef struct {
+    uint32_t page_nums[TREE_MAX_DEPTH];
+    uint32_t child_nums[TREE_MAX_DEPTH];
+    uint32_t depth;
+} TreePath;
+
+// True if the node can take one more cell without splitting
+bool table_node_is_safe(void* node) {
+    if (get_node_type(node) == NODE_LEAF) {
+        return *leaf_node_num_cells(node) < LEAF_NODE_MAX_CELLS;
+    }
+    return *internal_node_num_keys(node) < INTERNAL_NODE_MAX_KEYS;
+}
+
+// Position of the first key in the internal node not less than the key, which
+// is the child that holds or should hold it
+uint32_t internal_node_find_child(void* node, const void* key) {
+    uint32_t min_index = 0;
+    uint32_t max_index = *internal_node_num_keys(node);
+    while (min_index != max_index) {
+        uint32_t index = (min_index + max_index)/2;
+        if (compare_keys(internal_node_key(node, index), key) < 0) {
+            min_index = index + 1;
+        } else {
+            max_index = index;
+        }
+    }
+    return min_index;
+}
+
+// Position of the first cell in the leaf not less than the key
+uint32_t leaf_node_find(void* node, const void* key) {
+    uint32_t min_index = 0;
+    uint32_t max_index = *leaf_node_num_cells(node);
+    while (min_index != max_index) {
+        uint32_t index = (min_index + max_index)/2;
+        if (compare_keys(leaf_node_key(node, index), key) < 0) {
+            min_index = index + 1;
+        } else {
+            max_index = index;
+        }
+    }
+    return min_index;
+}
+
+void tree_path_push(TreePath* path, uint32_t page_num, uint32_t child_num) {
+    if (path->depth >= TREE_MAX_DEPTH) {
+        printf("Tree is deeper than %d levels. Corrupt file.\n", TREE_MAX_DEPTH);
+        exit(EXIT_FAILURE);
+    }
+    path->page_nums[path->depth] = page_num;
+    path->child_nums[path->depth] = child_num;
+    path->depth += 1;
+}
+
+// Descends to the leaf that holds or should hold the key, recording the path
+// taken. When the writer finds a leaf with no right sibling, it is remembered
+// as the rightmost.
+uint32_t table_find_leaf(Table* table, const void* key, TreePath* path, bool writing) {
+    Pager* pager = table->pager;
+    uint32_t page_num = table->root_page_num;
+    path->depth = 0;
+
+    void* node = get_page(pager, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t child_num = internal_node_find_child(node, key);
+        tree_path_push(path, page_num, child_num);
+
+        page_num = *internal_node_child(node, child_num);
+        node = get_page(pager, page_num);
+    }
+
+    if (writing && *leaf_node_next_leaf(node) == 0) {
+        memcpy(table->rightmost_path, path->page_nums, path->depth*sizeof(uint32_t));
+        table->rightmost_depth = path->depth;
+        table->rightmost_leaf = page_num;
+    }
+    return page_num;
+}
+
+// The append fast path. If the key is larger than every key in the table,
+// returns the rightmost leaf, with its cached path, as a descent would record
+// it. Returns 0 if the key is not an append.
+uint32_t table_find_append_leaf(Table* table, const void* key, TreePath* path) {
+    Pager* pager = table->pager;
+    uint32_t page_num = table->rightmost_leaf;
+    if (page_num == 0) {
+        return 0;
+    }
+    void* node = get_page(pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (num_cells == 0 || compare_keys(leaf_node_key(node, num_cells - 1), key) >= 0) {
+        return 0;
+    }
+
+    // Every node on the path to the rightmost leaf is followed by its right child
+    path->depth = 0;
+    for (uint32_t i = 0; i < table->rightmost_depth; i++) {
+        uint32_t parent_page_num = table->rightmost_path[i];
+        tree_path_push(path, parent_page_num, *internal_node_num_keys(get_page(pager, parent_page_num)));
+    }
+    return page_num;
+}
+
+// Pages an insert into the leaf would add: one for each node that splits, and
+// one more if the root does, as its cells move out to two new children
+uint32_t table_insert_new_pages(Table* table, TreePath* path, uint32_t leaf_page_num) {
+    Pager* pager = table->pager;
+    if (table_node_is_safe(get_page(pager, leaf_page_num))) {
+        return 0;
+    }
+    uint32_t new_pages = 1;
+    uint32_t depth = path->depth;
+    while (depth > 0 && !table_node_is_safe(get_page(pager, path->page_nums[depth - 1]))) {
+        new_pages += 1;
+        depth -= 1;
+    }
+    if (depth == 0) {
+        new_pages += 1;
+    }
+    return new_pages;
+}
+
+// Writes keys, laid out back to back, and children and their rows (one more
+// child than keys) into an internal node
+void internal_node_fill(void* node, const uint8_t* keys, uint32_t* children, uint32_t* rows, uint32_t num_keys) {
+    *internal_node_num_keys(node) = num_keys;
+    for (uint32_t i = 0; i <= num_keys; i++) {
+        *internal_node_child(node, i) = children[i];
+        *internal_node_child_rows(node, i) = rows[i];
+    }
+    for (uint32_t i = 0; i < num_keys; i++) {
+        memcpy(internal_node_key(node, i), keys + i*TABLE_KEY_SIZE, TABLE_KEY_SIZE);
+    }
+}
+
+// The rows in the subtree under the node
+uint32_t table_node_rows(void* node) {
+    if (get_node_type(node) == NODE_LEAF) {
+        return *leaf_node_num_cells(node);
+    }
+    uint32_t rows = 0;
+    for (uint32_t i = 0; i <= *internal_node_num_keys(node); i++) {
+        rows += *internal_node_child_rows(node, i);
+    }
+    return rows;
+}
+
+// The root has split into left and right, laid out in the buffers given. They
+// go to two new pages and the root becomes an internal node over them.
+void table_split_root(Table* table, const void* separator, void* left, void* right) {
+    Pager* pager = table->pager;
+    uint32_t left_page_num = get_unused_page_num(pager);
+    memcpy(get_page_for_write(pager, left_page_num), left, PAGE_SIZE);
+    uint32_t right_page_num = get_unused_page_num(pager);
+    memcpy(get_page_for_write(pager, right_page_num), right, PAGE_SIZE);
+    set_node_root(get_page_for_write(pager, left_page_num), false);
+    set_node_root(get_page_for_write(pager, right_page_num), false);
+
+    void* root = get_page_for_write(pager, table->root_page_num);
+    initialize_internal_node(root);
+    set_node_root(root, true);
+    uint32_t children[2] = { left_page_num, right_page_num };
+    uint32_t rows[2] = { table_node_rows(left), table_node_rows(right) };
+    internal_node_fill(root, separator, children, rows, 1);
+    if (get_node_type(left) == NODE_LEAF) {
+        *leaf_node_next_leaf(get_page_for_write(pager, left_page_num)) = right_page_num;
+    }
+}
+
+// Called after the node at the given depth of the path has been split into
+// left and right, with separator being the largest key left kept. Appends
+// split the rightmost internal nodes unevenly, as they do leaves.
+void table_insert_into_parent(Table* table, TreePath* path, uint32_t depth, uint32_t left_page_num,
+                              const void* separator, uint32_t right_page_num, bool appending) {
+    Pager* pager = table->pager;
+    uint32_t parent_page_num = path->page_nums[depth-1];
+    uint32_t child_num = path->child_nums[depth-1];
+    void* parent = get_page_for_write(pager, parent_page_num);
+    uint32_t num_keys = *internal_node_num_keys(parent);
+
+    // Lay the parent out flat with the separator and the new child in place
+    uint8_t keys[(INTERNAL_NODE_MAX_KEYS + 1)*TABLE_KEY_SIZE];
+    uint32_t children[INTERNAL_NODE_MAX_KEYS + 2];
+    uint32_t rows[INTERNAL_NODE_MAX_KEYS + 2];
+    for (uint32_t i = 0, j = 0; i <= num_keys; i++, j++) {
+        if (i == child_num) {
+            memcpy(keys + j*TABLE_KEY_SIZE, separator, TABLE_KEY_SIZE);
+            children[j] = left_page_num;
+            rows[j] = table_node_rows(get_page(pager, left_page_num));
+            j++;
+            children[j] = right_page_num;
+            rows[j] = table_node_rows(get_page(pager, right_page_num));
+        } else {
+            children[j] = *internal_node_child(parent, i);
+            rows[j] = *internal_node_child_rows(parent, i);
+        }
+        if (i < num_keys) {
+            memcpy(keys + j*TABLE_KEY_SIZE, internal_node_key(parent, i), TABLE_KEY_SIZE);
+        }
+    }
+    num_keys += 1;
+
+    if (num_keys <= INTERNAL_NODE_MAX_KEYS) {
+        internal_node_fill(parent, keys, children, rows, num_keys);
+        return;
+    }
+
+    // Split the parent, moving the key between the halves up a level
+    uint32_t left_num_keys = appending ? num_keys*9/10 : num_keys/2;
+    uint32_t right_num_keys = num_keys - left_num_keys - 1;
+    if (depth-1 == 0) {
+        uint8_t left[PAGE_SIZE] = {0};
+        uint8_t right[PAGE_SIZE] = {0};
+        initialize_internal_node(left);
+        initialize_internal_node(right);
+        internal_node_fill(left, keys, children, rows, left_num_keys);
+        internal_node_fill(right, keys + (left_num_keys + 1)*TABLE_KEY_SIZE, children + left_num_keys + 1,
+                           rows + left_num_keys + 1, right_num_keys);
+        table_split_root(table, keys + left_num_keys*TABLE_KEY_SIZE, left, right);
+        return;
+    }
+
+    uint32_t sibling_page_num = get_unused_page_num(pager);
+    void* sibling = get_page_for_write(pager, sibling_page_num);
+    initialize_internal_node(sibling);
+    internal_node_fill(parent, keys, children, rows, left_num_keys);
+    internal_node_fill(sibling, keys + (left_num_keys + 1)*TABLE_KEY_SIZE, children + left_num_keys + 1,
+                       rows + left_num_keys + 1, right_num_keys);
+
+    table_insert_into_parent(table, path, depth-1, parent_page_num, keys + left_num_keys*TABLE_KEY_SIZE,
+                             sibling_page_num, appending);
+}
+
+// Inserts the cell into the leaf at cell_num, splitting it if it is full
+void table_leaf_insert(Table* table, TreePath* path, uint32_t page_num, uint32_t cell_num,
+                       const void* key, void* value, bool appending) {
+    Pager* pager = table->pager;
+    void* node = get_page_for_write(pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+
+    if (num_cells < LEAF_NODE_MAX_CELLS) {
+        memmove(leaf_node_cell(node, cell_num+1), leaf_node_cell(node, cell_num),
+                (num_cells - cell_num)*LEAF_NODE_CELL_SIZE);
+        memcpy(leaf_node_key(node, cell_num), key, LEAF_NODE_KEY_SIZE);
+        memcpy(leaf_node_value(node, cell_num), value, ROW_SIZE);
+        *leaf_node_num_cells(node) += 1;
+        return;
+    }
+
+    // Leaf full. Lay the cells out flat with the new one in place, then keep
+    // the lower part and move the rest to a new right sibling.
+    uint8_t cells[(LEAF_NODE_MAX_CELLS + 1)*LEAF_NODE_CELL_SIZE];
+    memcpy(cells, leaf_node_cell(node, 0), cell_num*LEAF_NODE_CELL_SIZE);
+    memcpy(cells + cell_num*LEAF_NODE_CELL_SIZE, key, LEAF_NODE_KEY_SIZE);
+    memcpy(cells + cell_num*LEAF_NODE_CELL_SIZE + LEAF_NODE_KEY_SIZE, value, ROW_SIZE);
+    memcpy(cells + (cell_num+1)*LEAF_NODE_CELL_SIZE, leaf_node_cell(node, cell_num),
+           (num_cells - cell_num)*LEAF_NODE_CELL_SIZE);
+    num_cells += 1;
+    uint32_t left_num_cells = appending ? LEAF_NODE_APPEND_LEFT_SPLIT_COUNT : LEAF_NODE_LEFT_SPLIT_COUNT;
+    const uint8_t* separator = cells + (left_num_cells-1)*LEAF_NODE_CELL_SIZE;
+
+    if (path->depth == 0) {
+        uint8_t left[PAGE_SIZE] = {0};
+        uint8_t right[PAGE_SIZE] = {0};
+        initialize_leaf_node(left);
+        initialize_leaf_node(right);
+        memcpy(leaf_node_cell(left, 0), cells, left_num_cells*LEAF_NODE_CELL_SIZE);
+        *leaf_node_num_cells(left) = left_num_cells;
+        memcpy(leaf_node_cell(right, 0), cells + left_num_cells*LEAF_NODE_CELL_SIZE,
+               (num_cells - left_num_cells)*LEAF_NODE_CELL_SIZE);
+        *leaf_node_num_cells(right) = num_cells - left_num_cells;
+        table_split_root(table, separator, left, right);
+        return;
+    }
+
+    uint32_t sibling_page_num = get_unused_page_num(pager);
+    void* sibling = get_page_for_write(pager, sibling_page_num);
+    initialize_leaf_node(sibling);
+    *leaf_node_next_leaf(sibling) = *leaf_node_next_leaf(node);
+    *leaf_node_next_leaf(node) = sibling_page_num;
+
+    memcpy(leaf_node_cell(node, 0), cells, left_num_cells*LEAF_NODE_CELL_SIZE);
+    *leaf_node_num_cells(node) = left_num_cells;
+    memcpy(leaf_node_cell(sibling, 0), cells + left_num_cells*LEAF_NODE_CELL_SIZE,
+           (num_cells - left_num_cells)*LEAF_NODE_CELL_SIZE);
+    *leaf_node_num_cells(sibling) = num_cells - left_num_cells;
+
+    table_insert_into_parent(table, path, path->depth, page_num, separator, sibling_page_num, appending);
+}
+
+// Adds to the rows counted under each node on the path. Splits then set the
+// counts of the nodes they lay out.
+void table_path_add_rows(Table* table, TreePath* path, int32_t rows) {
+    for (uint32_t i = 0; i < path->depth; i++) {
+        void* node = get_page_for_write(table->pager, path->page_nums[i]);
+        *internal_node_child_rows(node, path->child_nums[i]) += rows;
+    }
+}
+
+// Inserts the serialized row under its key. Fails without changing anything if
+// the key is already in the table, or if the pages that splitting the table
+// could take and the extra pages the caller needs are not all free. Must be
+// called inside a write.
+ExecuteResult table_insert(Table* table, const void* key, void* value, uint32_t extra_pages) {
+    Pager* pager = table->pager;
+    TreePath path;
+    bool appending = true;
+    uint32_t page_num = table_find_append_leaf(table, key, &path);
+    uint32_t cell_num;
+    if (page_num != 0) {
+        cell_num = *leaf_node_num_cells(get_page(pager, page_num));
+    } else {
+        page_num = table_find_leaf(table, key, &path, true);
+        void* node = get_page(pager, page_num);
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        cell_num = leaf_node_find(node, key);
+        if (cell_num < num_cells && compare_keys(leaf_node_key(node, cell_num), key) == 0) {
+            return EXECUTE_DUPLICATE_KEY;
+        }
+        appending = (cell_num == num_cells && *leaf_node_next_leaf(node) == 0);
+    }
+
+    uint32_t new_pages = table_insert_new_pages(table, &path, page_num);
+    if (new_pages + extra_pages > pager_pages_available(pager)) {
+        return EXECUTE_TABLE_FULL;
+    }
+
+    if (new_pages > 0) {
+        // The rightmost path may change, so the next descent finds it again
+        table->rightmost_leaf = 0;
+    }
+    table_path_add_rows(table, &path, 1);
+    table_leaf_insert(table, &path, page_num, cell_num, key, value, appending);
+    return EXECUTE_SUCCESS;
+}
+
+// Removes the row with the key, returning false if there is none. Leaves are
+// not merged as they empty; cursors step over empty leaves. Must be called
+// inside a write.
+bool table_delete(Table* table, const void* key) {
+    Pager* pager = table->pager;
+    TreePath path;
+    uint32_t page_num = table_find_leaf(table, key, &path, true);
+    void* node = get_page(pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t cell_num = leaf_node_find(node, key);
+    bool found = cell_num < num_cells && compare_keys(leaf_node_key(node, cell_num), key) == 0;
+    if (found) {
+        table_path_add_rows(table, &path, -1);
+        node = get_page_for_write(pager, page_num);
+        memmove(leaf_node_cell(node, cell_num), leaf_node_cell(node, cell_num+1),
+                (num_cells - cell_num - 1)*LEAF_NODE_CELL_SIZE);
+        *leaf_node_num_cells(node) -= 1;
+    }
+    return found;
+}
+
+// Keys print as their id, or as "tenant_id, id" for tenants other than 0
+void print_key(const void* key) {
+    if (key_tenant_id(key) != 0) {
+        printf("%" PRIu64 ", ", key_tenant_id(key));
+    }
+    printf("%" PRIu64, key_id(key));
+}
+
+void print_leaf_node(void* node) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    printf("leaf (size %d)\n", num_cells);
+    for (uint32_t i=0; i < num_cells; i++) {
+        printf(" - %d : ", i);
+        print_key(leaf_node_key(node, i));
+        printf("\n");
+    }
+}
+
+void indent(uint32_t level) {
+    for (uint32_t i = 0; i < level; i++) {
+        printf("  ");
+    }
+}
+
+void print_tree_node(Pager* pager, uint32_t page_num, uint32_t indentation_level) {
+    void* node = get_page(pager, page_num);
+    if (get_node_type(node) == NODE_LEAF) {
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        indent(indentation_level);
+        printf("- leaf (size %d)\n", num_cells);
+        for (uint32_t i = 0; i < num_cells; i++) {
+            indent(indentation_level + 1);
+            printf("- ");
+            print_key(leaf_node_key(node, i));
+            printf("\n");
+        }
+        return;
+    }
+
+    uint32_t num_keys = *internal_node_num_keys(node);
+    indent(indentation_level);
+    printf("- internal (size %d)\n", num_keys);
+    for (uint32_t i = 0; i < num_keys; i++) {
+        print_tree_node(pager, *internal_node_child(node, i), indentation_level + 1);
+        indent(indentation_level + 1);
+        printf("- key ");
+        print_key(internal_node_key(node, i));
+        printf("\n");
+    }
+    print_tree_node(pager, *internal_node_right_child(node), indentation_level + 1);
+}
+
+void print_tree(Table* table) {
+    pager_begin_snapshot(table->pager);
+    print_tree_node(table->pager, table->root_page_num, 0);
+    pager_end_snapshot(table->pager);
+}
+
+// Moves the cursor past the end of empty or exhausted leaves
+void table_cursor_settle(Cursor* cursor) {
+    Pager* pager = cursor->table->pager;
+    void* node = get_page(pager, cursor->page_num);
+    while (cursor->cell_num >= *leaf_node_num_cells(node)) {
+        uint32_t next_page_num = *leaf_node_next_leaf(node);
+        if (next_page_num == 0) {
+            cursor->end_of_table = true;
+            return;
+        }
+        node = get_page(pager, next_page_num);
+        cursor->page_num = next_page_num;
+        cursor->cell_num = 0;
+    }
+}
+
+// Cursors on the stack are opened with table_start_cursor, table_end_cursor or
+// table_find_cursor and closed with cursor_close like any other, so the
+// engine's own scans and lookups allocate nothing for them.
+Cursor* table_start_cursor(Table* table, Cursor* cursor) {
+    cursor->table = table;
+    cursor->heap_allocated = false;
+    cursor->cell_num = 0;
+    cursor->end_of_table = false;
+    cursor->in_snapshot = true;
+
+    pager_begin_snapshot(table->pager);
+    uint32_t page_num = table->root_page_num;
+    void* node = get_page(table->pager, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        page_num = *internal_node_child(node, 0);
+        node = get_page(table->pager, page_num);
+    }
+    cursor->page_num = page_num;
+    table_cursor_settle(cursor);
+    return cursor;
+}
+
+// Positions the cursor at the end of the rightmost leaf, for the writer
+Cursor* table_end_cursor(Table* table, Cursor* cursor) {
+    cursor->table = table;
+    cursor->heap_allocated = false;
+    cursor->in_snapshot = false;
+
+    uint32_t page_num = table->root_page_num;
+    void* node = get_page(table->pager, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        page_num = *internal_node_right_child(node);
+        node = get_page(table->pager, page_num);
+    }
+    cursor->page_num = page_num;
+    cursor->cell_num = *leaf_node_num_cells(node);
+    cursor->end_of_table = true;
+    return cursor;
+}
+
+// The value stored under the key, or NULL if there is none. Must be called
+// inside a snapshot or a write.
+void* table_find_value(Table* table, const void* key) {
+    TreePath path;
+    void* node = get_page(table->pager, table_find_leaf(table, key, &path, false));
+    uint32_t cell_num = leaf_node_find(node, key);
+    if (cell_num < *leaf_node_num_cells(node) && compare_keys(leaf_node_key(node, cell_num), key) == 0) {
+        return leaf_node_value(node, cell_num);
+    }
+    return NULL;
+}
+
+// Positions the cursor at the first row whose key is not less than the key
+// given. The cursor reads a snapshot until it is closed.
+Cursor* table_find_cursor(Table* table, const void* key, Cursor* cursor) {
+    cursor->table = table;
+    cursor->heap_allocated = false;
+    cursor->end_of_table = false;
+    cursor->in_snapshot = true;
+
+    pager_begin_snapshot(table->pager);
+    TreePath path;
+    cursor->page_num = table_find_leaf(table, key, &path, false);
+    cursor->cell_num = leaf_node_find(get_page(table->pager, cursor->page_num), key);
+    table_cursor_settle(cursor);
+    return cursor;
+}
+
+// Descends to the child holding the row at the offset, counting off the rows
+// under the children before it. An offset past the last row ends up at the
+// end of the table.
+Cursor* table_offset_cursor(Table* table, uint64_t offset, Cursor* cursor) {
+    cursor->table = table;
+    cursor->heap_allocated = false;
+    cursor->end_of_table = false;
+    cursor->in_snapshot = true;
+
+    pager_begin_snapshot(table->pager);
+    uint32_t page_num = table->root_page_num;
+    void* node = get_page(table->pager, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t num_keys = *internal_node_num_keys(node);
+        uint32_t child_num = 0;
+        while (child_num < num_keys && offset >= *internal_node_child_rows(node, child_num)) {
+            offset -= *internal_node_child_rows(node, child_num);
+            child_num++;
+        }
+        page_num = *internal_node_child(node, child_num);
+        node = get_page(table->pager, page_num);
+    }
+    cursor->page_num = page_num;
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    cursor->cell_num = offset < num_cells ? offset : num_cells;
+    table_cursor_settle(cursor);
+    return cursor;
+}
+
+Cursor* table_start(Table* table) {
+    Cursor* cursor = table_start_cursor(table, malloc(sizeof(Cursor)));
+    cursor->heap_allocated = true;
+    return cursor;
+}
+
+Cursor* table_end(Table* table) {
+    Cursor* cursor = table_end_cursor(table, malloc(sizeof(Cursor)));
+    cursor->heap_allocated = true;
+    return cursor;
+}
+
+Cursor* table_find(Table* table, const void* key) {
+    Cursor* cursor = table_find_cursor(table, key, malloc(sizeof(Cursor)));
+    cursor->heap_allocated = true;
+    return cursor;
+}
+
+// The key of the row the cursor is on
+const void* cursor_key(Cursor* cursor) {
+    void* page = get_page(cursor->table->pager, cursor->page_num);
+    return leaf_node_key(page, cursor->cell_num);
+}
+
+void* cursor_value(Cursor* cursor) {
+    uint32_t page_num = cursor->page_num;
+    void* page = get_page(cursor->table->pager, page_num);
+    return leaf_node_value(page, cursor->cell_num);
+}
+
+void cursor_close(Cursor* cursor) {
+    if (cursor->in_snapshot) {
+        pager_end_snapshot(cursor->table->pager);
+    }
+    if (cursor->heap_allocated) {
+        free(cursor);
+    }
+}
+
+void cursor_advance(Cursor* cursor) {
+    cursor->cell_num+=1;
+    table_cursor_settle(cursor);
+}
+
+// Lists the table's leaf pages in key order by following the leaves from the
+// leftmost. Must be called inside a snapshot.
+uint32_t table_leaf_pages(Table* table, uint32_t* page_nums) {
+    Pager* pager = table->pager;
+    uint32_t page_num = table->root_page_num;
+    void* node = get_page(pager, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        page_num = *internal_node_child(node, 0);
+        node = get_page(pager, page_num);
+    }
+
+    uint32_t num_leaves = 0;
+    while (page_num != 0 && num_leaves < TABLE_MAX_PAGES) {
+        page_nums[num_leaves++] = page_num;
+        page_num = *leaf_node_next_leaf(get_page(pager, page_num));
+    }
+    return num_leaves;
+}
+
+// Frees the pages of the table's B-tree under the node, its own included
+void table_free_pages(Pager* pager, uint32_t page_num) {
+    void* node = get_page(pager, page_num);
+    if (get_node_type(node) == NODE_INTERNAL) {
+        for (uint32_t i = 0; i <= *internal_node_num_keys(node); i++) {
+            table_free_pages(pager, *internal_node_child(node, i));
+        }
+    }
+    free_page(pager, page_num);
+}
+
+// The catalog. Every table in the file has a record in it, and it is a table
+// itself: a B-tree keyed by table id (with tenant 0) whose values are catalog
+// records rather than rows. A record holds the table's name, its columns, its root page and
+// the roots of its indexes. Roots never move, so a record only changes when an
+// index is created. Files hold few tables, so looking one up by name scans.
+
+// Copies the table's record into record. Returns false if the table has been
+// dropped.
+bool catalog_read(Database* db, uint32_t id, void* record) {
+    uint8_t key[TABLE_KEY_SIZE];
+    encode_key(0, id, key);
+    Cursor cursor;
+    table_find_cursor(db->catalog, key, &cursor);
+    bool found = !(cursor.end_of_table) && compare_keys(cursor_key(&cursor), key) == 0;
+    if (found) {
+        memcpy(record, cursor_value(&cursor), ROW_SIZE);
+    }
+    cursor_close(&cursor);
+    return found;
+}
+
+// Returns the id of the named table, copying its record into record, or 0 if
+// there is no such table
+uint32_t catalog_find(Database* db, const char* name, void* record) {
+    uint32_t id = 0;
+    Cursor cursor;
+    table_start_cursor(db->catalog, &cursor);
+    while (!(cursor.end_of_table)) {
+        void* value = cursor_value(&cursor);
+        if (strncmp(catalog_name(value), name, CATALOG_NAME_SIZE) == 0) {
+            id = key_id(cursor_key(&cursor));
+            memcpy(record, value, ROW_SIZE);
+            break;
+        }
+        cursor_advance(&cursor);
+    }
+    cursor_close(&cursor);
+    return id;
+}
+
+// Replaces the table's record. Must be called inside a write.
+void catalog_write(Database* db, uint32_t id, void* record) {
+    Table* catalog = db->catalog;
+    uint8_t key[TABLE_KEY_SIZE];
+    encode_key(0, id, key);
+    TreePath path;
+    uint32_t page_num = table_find_leaf(catalog, key, &path, true);
+
+    void* node = get_page(catalog->pager, page_num);
+    uint32_t cell_num = leaf_node_find(node, key);
+    if (cell_num >= *leaf_node_num_cells(node) || compare_keys(leaf_node_key(node, cell_num), key) != 0) {
+        printf("Table %d is not in the catalog.\n", id);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(leaf_node_value(get_page_for_write(catalog->pager, page_num), cell_num), record, ROW_SIZE);
+}
+
+Table* table_open(Database* db, uint32_t id, const char* name, uint32_t root_page_num) {
+    Table* table = malloc(sizeof(Table));
+    table->db = db;
+    table->pager = db->pager;
+    table->id = id;
+    strncpy(table->name, name, TABLE_NAME_SIZE);
+    table->name[TABLE_NAME_SIZE] = '\0';
+    table->root_page_num = root_page_num;
+    table->keyed_by_tenant = false;
+    table->rightmost_leaf = 0;
+    table->next = NULL;
+    return table;
+}
+
+// The handle for the table with the id, made from its record the first time
+// it is asked for
+Table* database_table(Database* db, uint32_t id, void* record) {
+    pthread_mutex_lock(&(db->tables_lock));
+    Table* table = db->tables;
+    while (table != NULL && table->id != id) {
+        table = table->next;
+    }
+    if (table == NULL) {
+        if (!catalog_columns_match(record)) {
+            printf("Table %s has columns this build cannot read.\n", catalog_name(record));
+            exit(EXIT_FAILURE);
+        }
+        table = table_open(db, id, catalog_name(record), *catalog_root(record));
+        table->keyed_by_tenant = (*catalog_key_parts(record) == 2);
+        table->next = db->tables;
+        db->tables = table;
+    }
+    pthread_mutex_unlock(&(db->tables_lock));
+    return table;
+}
+
+Table* db_table(Table* table, const char* name) {
+    uint8_t record[ROW_SIZE];
+    uint32_t id = catalog_find(table->db, name, record);
+    if (id == 0) {
+        return NULL;
+    }
+    return database_table(table->db, id, record);
+}
+
+// Adds an empty table to the catalog. Must be called inside a write.
+ExecuteResult catalog_create_table(Database* db, const char* name, bool keyed_by_tenant) {
+    uint8_t record[ROW_SIZE];
+    if (catalog_find(db, name, record) != 0) {
+        return EXECUTE_TABLE_EXISTS;
+    }
+
+    // Ids are not reused while the file is open, so handles to dropped tables
+    // find nothing in the catalog
+    uint32_t id = 1;
+    Cursor cursor;
+    table_start_cursor(db->catalog, &cursor);
+    while (!(cursor.end_of_table)) {
+        id = key_id(cursor_key(&cursor)) + 1;
+        cursor_advance(&cursor);
+    }
+    cursor_close(&cursor);
+    if (db->next_table_id > id) {
+        id = db->next_table_id;
+    }
+
+    // The root's page is reserved by the insert and taken once it succeeds
+    initialize_catalog_record(record, name, 0, keyed_by_tenant);
+    uint8_t key[TABLE_KEY_SIZE];
+    encode_key(0, id, key);
+    ExecuteResult result = table_insert(db->catalog, key, record, 1);
+    if (result != EXECUTE_SUCCESS) {
+        return result;
+    }
+    db->next_table_id = id + 1;
+    uint32_t root_page_num = get_unused_page_num(db->pager);
+    void* root = get_page_for_write(db->pager, root_page_num);
+    initialize_leaf_node(root);
+    set_node_root(root, true);
+    *catalog_root(record) = root_page_num;
+    catalog_write(db, id, record);
+    return EXECUTE_SUCCESS;
+}
+
+// Frees the pages of the index's B-tree, defined with the indexes below
+void index_free_pages(Pager* pager, StringColumn column, uint32_t page_num);
+
+// Removes the table from the catalog and frees the pages of its B-tree and its
+// indexes. Must be called inside a write.
+ExecuteResult catalog_drop_table(Database* db, const char* name) {
+    uint8_t record[ROW_SIZE];
+    uint32_t id = catalog_find(db, name, record);
+    if (id == 0) {
+        return EXECUTE_NO_TABLE;
+    }
+    if (strcmp(name, DB_DEFAULT_TABLE) == 0) {
+        return EXECUTE_DEFAULT_TABLE;
+    }
+    uint8_t key[TABLE_KEY_SIZE];
+    encode_key(0, id, key);
+    table_delete(db->catalog, key);
+    table_free_pages(db->pager, *catalog_root(record));
+    for (StringColumn column = 0; column < NUM_STRING_COLUMNS; column++) {
+        uint32_t root_page_num = *catalog_index_root(record, column);
+        if (root_page_num != 0) {
+            index_free_pages(db->pager, column, root_page_num);
+        }
+    }
+    return EXECUTE_SUCCESS;
+}
+
+// One line for each table in the file, giving its name and columns
+void print_tables(Table* table) {
+    Cursor cursor;
+    table_start_cursor(table->db->catalog, &cursor);
+    while (!(cursor.end_of_table)) {
+        void* record = cursor_value(&cursor);
+        printf("%s (", catalog_name(record));
+        for (uint32_t i = 0; i < *catalog_num_columns(record) && i < CATALOG_MAX_COLUMNS; i++) {
+            void* column = catalog_column(record, i);
+            printf("%s%s", i == 0 ? "" : ", ", catalog_column_name(column));
+            if (*catalog_column_type(column) == COLUMN_TYPE_INTEGER) {
+                printf(" integer");
+            } else {
+                printf(" text(%d)", *catalog_column_length(column));
+            }
+        }
+        printf(")");
+        if (*catalog_key_parts(record) == 2) {
+            printf(" key (tenant_id, id)");
+        }
+        printf("\n");
+        cursor_advance(&cursor);
+    }
+    cursor_close(&cursor);
+}
+
+// Secondary indexes. Each indexed column has its own B-tree whose entries are
+// the serialized column bytes followed by the row id, ordered by column then id.
+// Internal node key i is the largest entry in child i. Nodes are reached by
+// descending from the root, so splits walk back up the recorded path rather
+// than following parent pointers. Each table keeps the roots of its indexes in
+// its catalog record. Like the table's, an index's root stays on the same page:
+// when it splits, its cells move out to a new page and it becomes the parent of
+// the two halves.
+
+typedef struct {
+    Table* table;
+    StringColumn column;
+    uint32_t page_num;
+    uint32_t cell_num;
+    bool end_of_index;
+} IndexCursor;
+
+uint32_t index_entry_size(StringColumn column) {
+    return string_column_size(column) + INDEX_ENTRY_KEY_SIZE;
+}
+
+void index_free_pages(Pager* pager, StringColumn column, uint32_t page_num) {
+    void* node = get_page(pager, page_num);
+    if (get_node_type(node) == NODE_INTERNAL) {
+        for (uint32_t i = 0; i <= *index_internal_node_num_keys(node); i++) {
+            index_free_pages(pager, column, *index_internal_node_child(node, index_entry_size(column), i));
+        }
+    }
+    free_page(pager, page_num);
+}
+
+// Builds the entry for a column value and the key of the row holding it. Bytes
+// after the terminator are zeroed, and keys are big endian, so entries order
+// as (value, key) under a single memcmp.
+void build_index_entry(StringColumn column, const char* value, const void* key, void* entry) {
+    uint32_t value_size = string_column_size(column);
+    size_t length = strnlen(value, value_size - 1);
+    memcpy(entry, value, length);
+    memset(entry + length, 0, value_size - length);
+    memcpy(entry + value_size, key, INDEX_ENTRY_KEY_SIZE);
+}
+
+int compare_index_entries(StringColumn column, const void* a, const void* b) {
+    return memcmp(a, b, index_entry_size(column));
+}
+
+// Descends to the leaf that should hold the entry, recording the path taken
+uint32_t index_find_leaf(Table* table, StringColumn column, uint32_t root_page_num, const void* entry,
+                         TreePath* path) {
+    Pager* pager = table->pager;
+    uint32_t entry_size = index_entry_size(column);
+    uint32_t page_num = root_page_num;
+    path->depth = 0;
+
+    void* node = get_page(pager, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        // Binary search for the first key not less than the entry
+        uint32_t min_index = 0;
+        uint32_t max_index = *index_internal_node_num_keys(node);
+        while (min_index != max_index) {
+            uint32_t index = (min_index + max_index)/2;
+            if (compare_index_entries(column, index_internal_node_entry(node, entry_size, index), entry) < 0) {
+                min_index = index + 1;
+            } else {
+                max_index = index;
+            }
+        }
+
+        if (path->depth >= TREE_MAX_DEPTH) {
+            printf("Index is deeper than %d levels. Corrupt file.\n", TREE_MAX_DEPTH);
+            exit(EXIT_FAILURE);
+        }
+        path->page_nums[path->depth] = page_num;
+        path->child_nums[path->depth] = min_index;
+        path->depth += 1;
+
+        page_num = *index_internal_node_child(node, entry_size, min_index);
+        node = get_page(pager, page_num);
+    }
+
+    return page_num;
+}
+
+// Position of the first cell in the leaf not less than the entry
+uint32_t index_leaf_node_find(void* node, StringColumn column, const void* entry) {
+    uint32_t entry_size = index_entry_size(column);
+    uint32_t min_index = 0;
+    uint32_t max_index = *index_leaf_node_num_cells(node);
+    while (min_index != max_index) {
+        uint32_t index = (min_index + max_index)/2;
+        if (compare_index_entries(column, index_leaf_node_entry(node, entry_size, index), entry) < 0) {
+            min_index = index + 1;
+        } else {
+            max_index = index;
+        }
+    }
+    return min_index;
+}
+
+// Writes keys and children (one more child than keys) into an internal node
+void index_internal_node_fill(void* node, uint32_t entry_size, void* keys, uint32_t* children, uint32_t num_keys) {
+    *index_internal_node_num_keys(node) = num_keys;
+    for (uint32_t i = 0; i < num_keys; i++) {
+        *index_internal_node_child(node, entry_size, i) = children[i];
+        memcpy(index_internal_node_entry(node, entry_size, i), keys + i*entry_size, entry_size);
+    }
+    *index_internal_node_right_child(node) = children[num_keys];
+}
+
+// Called after the node at the given depth of the path has been split into
+// left and right, with separator being the largest entry left kept.
+void index_insert_into_parent(Table* table, StringColumn column, TreePath* path, uint32_t depth,
+                              uint32_t left_page_num, const void* separator, uint32_t right_page_num) {
+    Pager* pager = table->pager;
+    uint32_t entry_size = index_entry_size(column);
+
+    if (depth == 0) {
+        // Split the root. Its cells, the left half, move to a new page, and it
+        // grows the tree by one level as their parent and right's.
+        uint32_t root_page_num = left_page_num;
+        left_page_num = get_unused_page_num(pager);
+        void* left = get_page_for_write(pager, left_page_num);
+        memcpy(left, get_page(pager, root_page_num), PAGE_SIZE);
+        set_node_root(left, false);
+        void* root = get_page_for_write(pager, root_page_num);
+        initialize_index_internal_node(root);
+        set_node_root(root, true);
+        uint32_t children[2] = { left_page_num, right_page_num };
+        index_internal_node_fill(root, entry_size, (void*)separator, children, 1);
+        return;
+    }
+
+    uint32_t parent_page_num = path->page_nums[depth-1];
+    uint32_t child_num = path->child_nums[depth-1];
+    void* parent = get_page_for_write(pager, parent_page_num);
+    uint32_t num_keys = *index_internal_node_num_keys(parent);
+
+    // Lay the parent out flat with the separator and the new child in place
+    uint8_t keys[PAGE_SIZE + INDEX_ENTRY_MAX_SIZE];
+    uint32_t children[PAGE_SIZE/INDEX_INTERNAL_NODE_CHILD_SIZE + 2];
+    for (uint32_t i = 0, j = 0; i <= num_keys; i++, j++) {
+        if (i == child_num) {
+            memcpy(keys + j*entry_size, separator, entry_size);
+            children[j] = left_page_num;
+            j++;
+            children[j] = right_page_num;
+        } else {
+            children[j] = *index_internal_node_child(parent, entry_size, i);
+        }
+        if (i < num_keys) {
+            memcpy(keys + j*entry_size, index_internal_node_entry(parent, entry_size, i), entry_size);
+        }
+    }
+    num_keys += 1;
+
+    if (num_keys <= index_internal_node_max_keys(entry_size)) {
+        index_internal_node_fill(parent, entry_size, keys, children, num_keys);
+        return;
+    }
+
+    // Split the parent, moving its middle key up a level
+    uint32_t left_num_keys = num_keys/2;
+    uint32_t sibling_page_num = get_unused_page_num(pager);
+    void* sibling = get_page_for_write(pager, sibling_page_num);
+    initialize_index_internal_node(sibling);
+    index_internal_node_fill(parent, entry_size, keys, children, left_num_keys);
+    index_internal_node_fill(sibling, entry_size, keys + (left_num_keys+1)*entry_size,
+                             children + left_num_keys + 1, num_keys - left_num_keys - 1);
+
+    index_insert_into_parent(table, column, path, depth-1,
+                             parent_page_num, keys + left_num_keys*entry_size, sibling_page_num);
+}
+
+void index_insert(Table* table, StringColumn column, uint32_t root_page_num, const void* key, void* row_value) {
+    Pager* pager = table->pager;
+    uint32_t entry_size = index_entry_size(column);
+    uint8_t entry[INDEX_ENTRY_MAX_SIZE];
+    build_index_entry(column, row_value + string_column_offset(column), key, entry);
+
+    TreePath path;
+    uint32_t page_num = index_find_leaf(table, column, root_page_num, entry, &path);
+    void* node = get_page(pager, page_num);
+    uint32_t num_cells = *index_leaf_node_num_cells(node);
+    uint32_t cell_num = index_leaf_node_find(node, column, entry);
+
+    if (cell_num < num_cells
+            && compare_index_entries(column, index_leaf_node_entry(node, entry_size, cell_num), entry) == 0) {
+        // Already indexed, e.g. a second row with the same id and value
+        return;
+    }
+
+    node = get_page_for_write(pager, page_num);
+
+    if (num_cells < index_leaf_node_max_cells(entry_size)) {
+        memmove(index_leaf_node_entry(node, entry_size, cell_num+1), index_leaf_node_entry(node, entry_size, cell_num),
+                (num_cells - cell_num)*entry_size);
+        memcpy(index_leaf_node_entry(node, entry_size, cell_num), entry, entry_size);
+        *index_leaf_node_num_cells(node) += 1;
+        return;
+    }
+
+    // Leaf full. Move the upper half of the cells, plus the new one, to a new right sibling.
+    uint8_t cells[PAGE_SIZE + INDEX_ENTRY_MAX_SIZE];
+    memcpy(cells, index_leaf_node_entry(node, entry_size, 0), cell_num*entry_size);
+    memcpy(cells + cell_num*entry_size, entry, entry_size);
+    memcpy(cells + (cell_num+1)*entry_size, index_leaf_node_entry(node, entry_size, cell_num),
+           (num_cells - cell_num)*entry_size);
+    num_cells += 1;
+    uint32_t left_num_cells = (num_cells+1)/2;
+
+    uint32_t sibling_page_num = get_unused_page_num(pager);
+    void* sibling = get_page_for_write(pager, sibling_page_num);
+    initialize_index_leaf_node(sibling);
+    *index_leaf_node_next_leaf(sibling) = *index_leaf_node_next_leaf(node);
+    *index_leaf_node_next_leaf(node) = sibling_page_num;
+
+    memcpy(index_leaf_node_entry(node, entry_size, 0), cells, left_num_cells*entry_size);
+    *index_leaf_node_num_cells(node) = left_num_cells;
+    memcpy(index_leaf_node_entry(sibling, entry_size, 0), cells + left_num_cells*entry_size,
+           (num_cells - left_num_cells)*entry_size);
+    *index_leaf_node_num_cells(sibling) = num_cells - left_num_cells;
+
+    index_insert_into_parent(table, column, &path, path.depth,
+                             page_num, cells + (left_num_cells-1)*entry_size, sibling_page_num);
+}
+
+// Skips past the end of empty or exhausted leaves
+void index_cursor_settle(IndexCursor* cursor) {
+    Pager* pager = cursor->table->pager;
+    void* node = get_page(pager, cursor->page_num);
+    while (cursor->cell_num >= *index_leaf_node_num_cells(node)) {
+        uint32_t next_page_num = *index_leaf_node_next_leaf(node);
+        if (next_page_num == 0) {
+            cursor->end_of_index = true;
+            return;
+        }
+        node = get_page(pager, next_page_num);
+        cursor->page_num = next_page_num;
+        cursor->cell_num = 0;
+    }
+}
+
+// Positions a cursor at the first entry not less than the entry given. The
+// cursor reads a snapshot until it is closed.
+void index_seek(Table* table, StringColumn column, uint32_t root_page_num, const void* entry, IndexCursor* cursor) {
+    TreePath path;
+    pager_begin_snapshot(table->pager);
+    cursor->table = table;
+    cursor->column = column;
+    cursor->page_num = index_find_leaf(table, column, root_page_num, entry, &path);
+    cursor->cell_num = index_leaf_node_find(get_page(table->pager, cursor->page_num), column, entry);
+    cursor->end_of_index = false;
+    index_cursor_settle(cursor);
+}
+
+void* index_cursor_entry(IndexCursor* cursor) {
+    void* node = get_page(cursor->table->pager, cursor->page_num);
+    return index_leaf_node_entry(node, index_entry_size(cursor->column), cursor->cell_num);
+}
+
+void index_cursor_advance(IndexCursor* cursor) {
+    cursor->cell_num += 1;
+    index_cursor_settle(cursor);
+}
+
+void index_cursor_close(IndexCursor* cursor) {
+    pager_end_snapshot(cursor->table->pager);
+}
+
+// Creates an empty index on the column and fills it from the rows already in
+// the table, recording its root in the table's catalog record. Readers do not
+// see the index until the write commits, by which time it is filled in. Must
+// be called inside a write.
+void index_create(Table* table, StringColumn column, void* record) {
+    Pager* pager = table->pager;
+
+    uint32_t root_page_num = get_unused_page_num(pager);
+    void* root = get_page_for_write(pager, root_page_num);
+    initialize_index_leaf_node(root);
+    set_node_root(root, true);
+    *catalog_index_root(record, column) = root_page_num;
+    catalog_write(table->db, table->id, record);
+
+    Cursor cursor;
+    table_start_cursor(table, &cursor);
+    while (!(cursor.end_of_table)) {
+        index_insert(table, column, root_page_num, cursor_key(&cursor), cursor_value(&cursor));
+        cursor_advance(&cursor);
+    }
+    cursor_close(&cursor);
+}
+
+uint32_t index_levels(Table* table, StringColumn column, uint32_t root_page_num) {
+    Pager* pager = table->pager;
+    uint32_t entry_size = index_entry_size(column);
+    void* node = get_page(pager, root_page_num);
+    uint32_t levels = 1;
+    while (get_node_type(node) == NODE_INTERNAL) {
+        node = get_page(pager, *index_internal_node_child(node, entry_size, 0));
+        levels += 1;
+    }
+    return levels;
+}
+
+// Most pages that building an index on the column over the rows already in the
+// table could take. Nodes split in half, so every node but the root is at
+// least half full.
+uint32_t index_create_pages(Table* table, StringColumn column) {
+    Pager* pager = table->pager;
+    uint32_t leaf_page_nums[TABLE_MAX_PAGES];
+    uint32_t num_leaves = table_leaf_pages(table, leaf_page_nums);
+    uint32_t num_rows = 0;
+    for (uint32_t i = 0; i < num_leaves; i++) {
+        num_rows += *leaf_node_num_cells(get_page(pager, leaf_page_nums[i]));
+    }
+
+    uint32_t entry_size = index_entry_size(column);
+    uint32_t num_nodes = num_rows/(index_leaf_node_max_cells(entry_size)/2) + 1;
+    uint32_t pages = num_nodes;
+    while (num_nodes > 1) {
+        num_nodes = num_nodes/(index_internal_node_max_keys(entry_size)/2 + 1) + 1;
+        pages += num_nodes;
+    }
+    return pages;
+}
+
+// Threads a scan may use out of those asked for: between 1 and
+// SCAN_MAX_THREADS
+uint32_t scan_threads_allowed(uint32_t num_threads) {
+    if (num_threads < 1) {
+        return 1;
+    }
+    return num_threads < SCAN_MAX_THREADS ? num_threads : SCAN_MAX_THREADS;
+}
+
+// A fixed set of worker threads that run one job at a time. The thread that
+// runs a job takes part as worker 0, so a pool of n threads starts n-1. Jobs
+// run from more than one thread wait their turn.
+typedef struct {
+    ThreadPool* pool;
+    uint32_t id;
+} ThreadPoolWorker;
+
+struct ThreadPool {
+    uint32_t num_threads;
+    pthread_t threads[SCAN_MAX_THREADS];
+    ThreadPoolWorker workers[SCAN_MAX_THREADS];
+    pthread_mutex_t run_lock; // held by the thread whose job is running
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready;
+    pthread_cond_t job_done;
+    void (*job)(void* arg, uint32_t worker);
+    void* job_arg;
+    uint64_t job_generation;
+    uint32_t num_busy;
+    bool closing;
+};
+
+void* thread_pool_worker(void* arg) {
+    ThreadPoolWorker* worker = arg;
+    ThreadPool* pool = worker->pool;
+    uint64_t generation = 0;
+
+    pthread_mutex_lock(&(pool->lock));
+    while (true) {
+        while (!(pool->closing) && pool->job_generation == generation) {
+            pthread_cond_wait(&(pool->job_ready), &(pool->lock));
+        }
+        if (pool->closing) {
+            break;
+        }
+        generation = pool->job_generation;
+        void (*job)(void* arg, uint32_t worker) = pool->job;
+        void* job_arg = pool->job_arg;
+        pthread_mutex_unlock(&(pool->lock));
+
+        job(job_arg, worker->id);
+
+        pthread_mutex_lock(&(pool->lock));
+        pool->num_busy -= 1;
+        if (pool->num_busy == 0) {
+            pthread_cond_signal(&(pool->job_done));
+        }
+    }
+    pthread_mutex_unlock(&(pool->lock));
+    return NULL;
+}
+
+ThreadPool* thread_pool_open(uint32_t num_threads) {
+    ThreadPool* pool = malloc(sizeof(ThreadPool));
+    pool->num_threads = scan_threads_allowed(num_threads);
+    pthread_mutex_init(&(pool->run_lock), NULL);
+    pthread_mutex_init(&(pool->lock), NULL);
+    pthread_cond_init(&(pool->job_ready), NULL);
+    pthread_cond_init(&(pool->job_done), NULL);
+    pool->job_generation = 0;
+    pool->num_busy = 0;
+    pool->closing = false;
+
+    for (uint32_t i = 1; i < pool->num_threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        if (pthread_create(&(pool->threads[i]), NULL, thread_pool_worker, &(pool->workers[i])) != 0) {
+            printf("Unable to start a scan thread.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return pool;
+}
+
+// Runs the job on every worker and waits for them all to return
+void thread_pool_run(ThreadPool* pool, void (*job)(void* arg, uint32_t worker), void* arg) {
+    pthread_mutex_lock(&(pool->run_lock));
+    pthread_mutex_lock(&(pool->lock));
+    pool->job = job;
+    pool->job_arg = arg;
+    pool->job_generation += 1;
+    pool->num_busy = pool->num_threads - 1;
+    pthread_cond_broadcast(&(pool->job_ready));
+    pthread_mutex_unlock(&(pool->lock));
+
+    job(arg, 0);
+
+    pthread_mutex_lock(&(pool->lock));
+    while (pool->num_busy > 0) {
+        pthread_cond_wait(&(pool->job_done), &(pool->lock));
+    }
+    pthread_mutex_unlock(&(pool->lock));
+    pthread_mutex_unlock(&(pool->run_lock));
+}
+
+void thread_pool_close(ThreadPool* pool) {
+    pthread_mutex_lock(&(pool->lock));
+    pool->closing = true;
+    pthread_cond_broadcast(&(pool->job_ready));
+    pthread_mutex_unlock(&(pool->lock));
+
+    for (uint32_t i = 1; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&(pool->job_ready));
+    pthread_cond_destroy(&(pool->job_done));
+    pthread_mutex_destroy(&(pool->lock));
+    pthread_mutex_destroy(&(pool->run_lock));
+    free(pool);
+}
+
+// The database's scan pool, started on the first scan that uses it
+ThreadPool* db_scan_pool(Database* db) {
+    pthread_mutex_lock(&(db->scan_pool_lock));
+    if (db->scan_pool == NULL) {
+        db->scan_pool = thread_pool_open(db->scan_threads);
+    }
+    ThreadPool* pool = db->scan_pool;
+    pthread_mutex_unlock(&(db->scan_pool_lock));
+    return pool;
+}
+
+// Threads a parallel scan of the database would run on
+uint32_t db_scan_threads(Database* db) {
+    pthread_mutex_lock(&(db->scan_pool_lock));
+    uint32_t num_threads = db->scan_pool != NULL ? db->scan_pool->num_threads : scan_threads_allowed(db->scan_threads);
+    pthread_mutex_unlock(&(db->scan_pool_lock));
+    return num_threads;
+}
+
+uint32_t online_cores() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long cores = info.dwNumberOfProcessors;
+#else
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (cores < 1) {
+        return 1;
+    }
+    return cores < SCAN_MAX_THREADS ? cores : SCAN_MAX_THREADS;
+}
+
+// Writes every cached page back to the file in one batch
+void pager_flush_all(Pager* pager) {
+    uint64_t start = stats_clock_ns();
+    uint32_t page_nums[TABLE_MAX_PAGES];
+    void* pages[TABLE_MAX_PAGES];
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < pager->num_pages; i++) {
+        PageVersion* version = __atomic_load_n(&(pager->pages[i]), __ATOMIC_ACQUIRE);
+        if (version != NULL) {
+            page_nums[count] = i;
+            pages[count] = version->data;
+            count++;
+        }
+    }
+    pager_write_pages(pager, page_nums, pages, count);
+    stats_record_latency(TIMER_FLUSH, start);
+}
+
+Pager* pager_open(const char* filename, OpenFlags flags) {
+    // int fd = _open(filename,
+    //               _O_RDWR | //Read/Write mode
+    //               _O_CREAT, //Create files if it does not exist
+    //               _S_IREAD | //User write permission
+    //               _S_IWRITE //User read permission
+    // );
+  int fd = open(filename,
+                O_RDWR |      // Read/Write mode
+                    O_CREAT | // Create file if it does not exist
+                    ((flags & DB_OPEN_DIRECT) ? O_DIRECT : 0), // Bypass the OS page cache
+                S_IWUSR |     // User write permission
+                    S_IRUSR   // User read permission
+                );
+    if (fd== -1) {
+        if ((flags & DB_OPEN_DIRECT) && errno == EINVAL) {
+            printf("Direct I/O is not supported for this file\n");
+            exit(EXIT_FAILURE);
+        }
+        printf("Unable to open file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    off_t file_length = lseek(fd, 0, SEEK_END);
+
+    Pager* pager = malloc(sizeof(Pager));
+    pager->file_descriptor = fd;
+    pager->direct_io = (flags & DB_OPEN_DIRECT) != 0;
+    pager->page_slab = slab_open(PAGE_SIZE, SLAB_HUGE_CHUNK_SIZE);
+    pager->version_slab = slab_open(sizeof(PageVersion), SLAB_SMALL_CHUNK_SIZE);
+    pager->page_map = NULL;
+
+    // A compressed file starts with its page map rather than a page
+    if (file_length == 0 && (flags & DB_OPEN_COMPRESSED)) {
+        pager->page_map = page_map_open(NULL);
+    } else if (file_length >= PAGE_SIZE) {
+        void* first_page = slab_allocate(pager->page_slab);
+        if (pread(fd, first_page, PAGE_SIZE, 0) != PAGE_SIZE) {
+            printf("Error reading file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        if (*(uint32_t*)(first_page + PAGE_MAP_MAGIC_OFFSET) == PAGE_MAP_MAGIC) {
+            pager->page_map = page_map_open(first_page);
+        }
+        slab_free(pager->page_slab, first_page);
+    }
+
+    if (pager->page_map != NULL) {
+        pager->num_pages = page_map_num_pages(pager->page_map);
+        pager->file_length = pager->num_pages*PAGE_SIZE;
+    } else {
+        pager->file_length = file_length;
+        pager->num_pages = (file_length/PAGE_SIZE);
+        if (file_length % PAGE_SIZE != 0 ) {
+            printf("Db files is not a whole number of pages. Corrupt file.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_mutex_init(&(pager->lock), NULL);
+    for (int32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+        pager->pages[i] = NULL;
+        pager->uncommitted[i] = NULL;
+    }
+    pager->committed_version = 0;
+    pager->last_miss = TABLE_MAX_PAGES;
+    pager->read_ahead_head = 0;
+    pager->read_ahead_tail = 0;
+    pager->read_ahead_running = false;
+    pager->read_ahead_closing = false;
+    pthread_cond_init(&(pager->read_ahead_ready), NULL);
+#ifdef DB_IO_URING
+    pager->io_ring = io_ring_open();
+#else
+    pager->io_ring = NULL;
+#endif
+    pthread_mutex_init(&(pager->snapshot_lock), NULL);
+    for (uint32_t i = 0; i < PAGER_MAX_SNAPSHOTS; i++) {
+        pager->snapshot_open[i] = false;
+    }
+
+    return pager;
+}
+
+// Write statements run one at a time, each committing as a transaction of its
+// own that snapshots begun afterwards will see
+void table_begin_write(Table* table) {
+    pthread_mutex_lock(&(table->db->write_lock));
+    pager_begin_write(table->pager);
+}
+
+void table_end_write(Table* table) {
+    pager_commit_write(table->pager);
+    pthread_mutex_unlock(&(table->db->write_lock));
+}
+
+Table* db_open(const char* filename) {
+    return db_open_with(filename, DB_OPEN_DEFAULT);
+}
+
+Table* db_open_with(const char* filename, OpenFlags flags) {
+    Pager* pager = pager_open(filename, flags);
+
+    Database* db = malloc(sizeof(Database));
+    db->pager = pager;
+    db->in_transaction = false;
+    pthread_mutex_init(&(db->write_lock), NULL);
+    db->scan_threads = online_cores();
+    db->scan_pool = NULL;
+    pthread_mutex_init(&(db->scan_pool_lock), NULL);
+    db->sort_memory = SORT_DEFAULT_MEMORY;
+    db->join_memory = JOIN_DEFAULT_MEMORY;
+    pthread_mutex_init(&(db->tables_lock), NULL);
+    db->tables = NULL;
+    db->next_table_id = 0;
+
+    bool new_file = (pager->num_pages == 0);
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    if (new_file) {
+    // New database file. Initialize page 0 as the header and page 1 as the catalog's root leaf node.
+        *header_magic(header) = DB_HEADER_MAGIC;
+        *header_format(header) = DB_FORMAT_VERSION;
+        *header_catalog_root(header) = CATALOG_ROOT_PAGE_NUM;
+        *header_num_free_pages(header) = 0;
+        void* root_node = get_page(pager, CATALOG_ROOT_PAGE_NUM);
+        initialize_leaf_node(root_node);
+        set_node_root(root_node, true);
+    } else if (*header_magic(header) != DB_HEADER_MAGIC) {
+        printf("Db file has no database header. Corrupt file.\n");
+        exit(EXIT_FAILURE);
+    } else if (*header_format(header) != DB_FORMAT_VERSION) {
+        printf("Db file is in format %d, which this build cannot read.\n", *header_format(header));
+        exit(EXIT_FAILURE);
+    }
+    db->catalog = table_open(db, 0, "", *header_catalog_root(header));
+
+    if (new_file) {
+        table_begin_write(db->catalog);
+        catalog_create_table(db, DB_DEFAULT_TABLE, false);
+        table_end_write(db->catalog);
+    }
+    Table* table = db_table(db->catalog, DB_DEFAULT_TABLE);
+    if (table == NULL) {
+        printf("Db file has no %s table. Corrupt file.\n", DB_DEFAULT_TABLE);
+        exit(EXIT_FAILURE);
+    }
+    return table;
+}
+
+void db_close(Table* table) {
+    Database* db = table->db;
+    Pager* pager = db->pager;
+
+    if (db->scan_pool != NULL) {
+        thread_pool_close(db->scan_pool);
+    }
+    if (pager->read_ahead_running) {
+        pthread_mutex_lock(&(pager->lock));
+        pager->read_ahead_closing = true;
+        pthread_cond_signal(&(pager->read_ahead_ready));
+        pthread_mutex_unlock(&(pager->lock));
+        pthread_join(pager->read_ahead_thread, NULL);
+    }
+
+    // Cursors read snapshots, so one still open means a cursor was not closed
+    for (uint32_t i = 0; i < PAGER_MAX_SNAPSHOTS; i++) {
+        if (pager->snapshot_open[i]) {
+            printf("Tried to close the db with a snapshot still open.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    pager_flush_all(pager);
+
+    // //There may be a partial page remaining at the end. However, this won't be required once a B-Tree structure is implemented for the pager
+    // uint32_t num_additional_rows = table->num_rows % ROWS_PER_PAGE;
+    // if (num_additional_rows>0) {
+    //     uint32_t page_num  = num_full_pages;
+    //     if (pager->pages[page_num] != NULL) {
+    //         pager_flush(pager, page_num, num_additional_rows*ROW_SIZE);
+    //         free(pager->pages[page_num]);
+    //         pager->pages[page_num] = NULL;
+    //     }
+    // }
+
+#ifdef DB_IO_URING
+    if (pager->io_ring != NULL) {
+        io_ring_close(pager->io_ring);
+    }
+#endif
+    int result = close(pager->file_descriptor);
+    if (result == -1) {
+        printf("Error closing the db file.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i=0;i<TABLE_MAX_PAGES;i++) {
+        pager->pages[i] = NULL;
+    }
+    if (pager->page_map != NULL) {
+        page_map_close(pager->page_map);
+    }
+    // Every page and version came from the slabs, so releasing their chunks frees them all
+    slab_close(pager->page_slab);
+    slab_close(pager->version_slab);
+    pthread_mutex_destroy(&(pager->lock));
+    pthread_mutex_destroy(&(pager->snapshot_lock));
+    pthread_cond_destroy(&(pager->read_ahead_ready));
+    pthread_mutex_destroy(&(db->write_lock));
+    pthread_mutex_destroy(&(db->tables_lock));
+    pthread_mutex_destroy(&(db->scan_pool_lock));
+    while (db->tables != NULL) {
+        Table* next = db->tables->next;
+        free(db->tables);
+        db->tables = next;
+    }
+    free(db->catalog);
+    free(pager);
+    free(db);
+}
+
+void db_set_scan_threads(Table* table, uint32_t num_threads) {
+    table->db->scan_threads = num_threads;
+}
+
+void db_set_sort_memory(Table* table, size_t bytes) {
+    table->db->sort_memory = bytes;
+}
+
+void db_set_join_memory(Table* table, size_t bytes) {
+    table->db->join_memory = bytes;
+}
+
+ExecuteResult db_begin(Table* table) {
+    if (table->db->in_transaction) {
+        return EXECUTE_FAILURE;
+    }
+    table->db->in_transaction = true;
+    return EXECUTE_SUCCESS;
+}
+
+// Writes every cached page back and waits for it to reach the disk
+ExecuteResult db_commit(Table* table) {
+    Database* db = table->db;
+    if (!(db->in_transaction)) {
+        return EXECUTE_FAILURE;
+    }
+
+    // Taking the write lock keeps pages from changing while they are written
+    pthread_mutex_lock(&(db->write_lock));
+    Pager* pager = table->pager;
+    pager_flush_all(pager);
+    pager_sync(pager);
+    pthread_mutex_unlock(&(db->write_lock));
+
+    db->in_transaction = false;
+    return EXECUTE_SUCCESS;
+}
+
+void db_begin_snapshot(Table* table) {
+    pager_begin_snapshot(table->pager);
+}
+
+void db_end_snapshot(Table* table) {
+    pager_end_snapshot(table->pager);
+}
+
+// Copies the row with the id into *row. Returns false if there is none.
+bool db_get(Table* table, uint64_t id, Row* row) {
+    return db_get_tenant(table, 0, id, row);
+}
+
+// As db_get, for tables keyed by (tenant_id, id)
+bool db_get_tenant(Table* table, uint64_t tenant_id, uint64_t id, Row* row) {
+    uint8_t key[TABLE_KEY_SIZE];
+    encode_key(tenant_id, id, key);
+    Cursor cursor;
+    table_find_cursor(table, key, &cursor);
+    bool found = !(cursor.end_of_table) && compare_keys(cursor_key(&cursor), key) == 0;
+    if (found) {
+        deserialize_row(cursor_value(&cursor), row);
+    }
+    cursor_close(&cursor);
+    return found;
+}
+
+
+
+
+// void free_table(Table* table) {
+//     for (int i=0; table->pages[i]; i++) {
+//         free(table->pages[i]);
+//     }
+//     free(table);
+// }
+
+// Permanent code below
+
+// Statements are tokenised in place without modifying the text, so the same
+// string can be prepared again or kept in the statement cache.
+typedef struct {
+    const char* start;
+    size_t length;
+} Token;
+
+// Splits the next space separated token off the front of *sql
+bool next_token(const char** sql, Token* token) {
+    const char* position = *sql;
+    while (*position == ' ') {
+        position++;
+    }
+    if (*position == '\0') {
+        return false;
+    }
+    token->start = position;
+    while (*position != ' ' && *position != '\0') {
+        position++;
+    }
+    token->length = position - token->start;
+    *sql = position;
+    return true;
+}
+
+bool token_equals(Token* token, const char* word) {
+    return strlen(word) == token->length && memcmp(token->start, word, token->length) == 0;
+}
+
+bool token_is_placeholder(Token* token) {
+    return token->length == 1 && token->start[0] == '?';
+}
+
+// Records that the next placeholder in the statement fills the target
+PrepareResult add_param(Statement* statement, ParamTarget target) {
+    if (statement->num_params >= STATEMENT_MAX_PARAMS) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    statement->params[statement->num_params] = target;
+    statement->num_params += 1;
+    return PREPARE_SUCCESS;
+}
+
+// Parses an unsigned 64-bit id, rejecting any that would overflow
+PrepareResult parse_id(const char* value, size_t length, uint64_t* id) {
+    if (length > 0 && value[0] == '-') {
+        return PREPARE_NEGATIVE_ID;
+    }
+    if (length == 0) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    uint64_t result = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (value[i] < '0' || value[i] > '9') {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        uint64_t digit = value[i] - '0';
+        if (result > (UINT64_MAX - digit)/10) {
+            return PREPARE_ID_TOO_LARGE;
+        }
+        result = result*10 + digit;
+    }
+    *id = result;
+    return PREPARE_SUCCESS;
+}
+
+PrepareResult copy_column_value(char* destination, size_t max_length, const char* value, size_t length) {
+    if (length > max_length) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    memcpy(destination, value, length);
+    destination[length] = '\0';
+    return PREPARE_SUCCESS;
+}
+
+// Sets the value a prepared filter compares against. Patterns for like must
+// be of the form prefix%.
+PrepareResult set_filter_value(Filter* filter, const char* value, size_t length) {
+    if (filter->type == FILTER_PREFIX) {
+        if (length == 0 || value[length-1] != '%' || memchr(value, '%', length-1) != NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        length -= 1;
+    }
+
+    if (length >= string_column_size(filter->column)) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+
+    memcpy(filter->value, value, length);
+    filter->value[length] = '\0';
+    filter->value_length = length;
+    return PREPARE_SUCCESS;
+}
+
+// Table names are letters, digits and underscores, and do not start with a digit
+PrepareResult parse_table_name(Token* name, char* destination) {
+    if (name->length > TABLE_NAME_SIZE) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    if (name->start[0] >= '0' && name->start[0] <= '9') {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    for (size_t i = 0; i < name->length; i++) {
+        char c = name->start[i];
+        bool allowed = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+        if (!allowed) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+    memcpy(destination, name->start, name->length);
+    destination[name->length] = '\0';
+    return PREPARE_SUCCESS;
+}
+
+// Parses "insert [into <table>] [<tenant_id>] <id> <username> <email>", where
+// any of the values may be a placeholder. The tenant is only given for tables
+// keyed by (tenant_id, id).
+PrepareResult prepare_insert(const char* sql, Statement* statement) {
+    statement->type = STATEMENT_INSERT;
+
+    Token keyword, values[4], extra;
+    next_token(&sql, &keyword);
+    if (!next_token(&sql, &values[0])) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    PrepareResult result;
+    if (token_equals(&values[0], "into")) {
+        Token name;
+        if (!next_token(&sql, &name)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        result = parse_table_name(&name, statement->table_name);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        if (!next_token(&sql, &values[0])) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+    uint32_t num_values = 1;
+    while (num_values < 4 && next_token(&sql, &values[num_values])) {
+        num_values++;
+    }
+    if (num_values < 3 || next_token(&sql, &extra)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    Row* row = &(statement->row_to_insert);
+    statement->with_tenant = (num_values == 4);
+    row->tenant_id = 0;
+    Token* value = values;
+    if (statement->with_tenant) {
+        if (token_is_placeholder(value)) {
+            result = add_param(statement, PARAM_TENANT_ID);
+        } else {
+            result = parse_id(value->start, value->length, &(row->tenant_id));
+        }
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        value++;
+    }
+
+    if (token_is_placeholder(value)) {
+        result = add_param(statement, PARAM_ID);
+    } else {
+        result = parse_id(value->start, value->length, &(row->id));
+    }
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+    value++;
+
+    if (token_is_placeholder(value)) {
+        result = add_param(statement, PARAM_USERNAME);
+    } else {
+        result = copy_column_value(row->username, COLUMN_USERNAME_SIZE, value->start, value->length);
+    }
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+    value++;
+
+    if (token_is_placeholder(value)) {
+        return add_param(statement, PARAM_EMAIL);
+    }
+    return copy_column_value(row->email, COLUMN_EMAIL_SIZE, value->start, value->length);
+}
+
+bool parse_string_column(Token* name, StringColumn* column) {
+    for (StringColumn i = 0; i < NUM_STRING_COLUMNS; i++) {
+        if (token_equals(name, string_column_names[i])) {
+            *column = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The key clause of create table, which is only written one way
+#define TENANT_KEY_CLAUSE "key (tenant_id, id)"
+
+// Parses "create table <name> [key (tenant_id, id)]" and
+// "create index on [<table>] <username|email>"
+PrepareResult prepare_create(const char* sql, Statement* statement) {
+    Token keyword, object, extra;
+    next_token(&sql, &keyword);
+    if (!next_token(&sql, &object)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    if (token_equals(&object, "table")) {
+        statement->type = STATEMENT_CREATE_TABLE;
+        Token name;
+        if (!next_token(&sql, &name)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        while (*sql == ' ') {
+            sql++;
+        }
+        statement->with_tenant = (strcmp(sql, TENANT_KEY_CLAUSE) == 0);
+        if (!(statement->with_tenant) && next_token(&sql, &extra)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        return parse_table_name(&name, statement->table_name);
+    }
+
+    statement->type = STATEMENT_CREATE_INDEX;
+    Token on, column;
+    if (!token_equals(&object, "index") || !next_token(&sql, &on) || !token_equals(&on, "on")
+            || !next_token(&sql, &column)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (next_token(&sql, &extra)) {
+        // The first of two names is the table
+        PrepareResult result = parse_table_name(&column, statement->table_name);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        column = extra;
+        if (next_token(&sql, &extra)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+    if (!parse_string_column(&column, &(statement->index_column))) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    return PREPARE_SUCCESS;
+}
+
+// Parses "drop table <name>"
+PrepareResult prepare_drop(const char* sql, Statement* statement) {
+    statement->type = STATEMENT_DROP_TABLE;
+
+    Token keyword, object, name, extra;
+    next_token(&sql, &keyword);
+    if (!next_token(&sql, &object) || !token_equals(&object, "table") || !next_token(&sql, &name)
+            || next_token(&sql, &extra)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return parse_table_name(&name, statement->table_name);
+}
+
+// Parses the where clause of a select
+PrepareResult prepare_where(Statement* statement, Token* column, Token* operator, Token* value) {
+    Filter* filter = &(statement->filter);
+    if (token_equals(column, "tenant_id")) {
+        filter->type = FILTER_TENANT;
+        if (!token_equals(operator, "=")) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if (token_is_placeholder(value)) {
+            return add_param(statement, PARAM_FILTER_TENANT);
+        }
+        return parse_id(value->start, value->length, &(filter->tenant_id));
+    }
+    if (!parse_string_column(column, &(filter->column))) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    if (token_equals(operator, "=")) {
+        filter->type = FILTER_EQUALS;
+    } else if (token_equals(operator, "like")) {
+        filter->type = FILTER_PREFIX;
+    } else {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    if (token_is_placeholder(value)) {
+        return add_param(statement, PARAM_FILTER_VALUE);
+    }
+
+    const char* start = value->start;
+    uint32_t length = value->length;
+    if (length >= 2 && start[0] == '\'' && start[length-1] == '\'') {
+        start += 1;
+        length -= 2;
+    }
+    return set_filter_value(filter, start, length);
+}
+
+// Limits too large for a uint32_t are no limit at all, and offsets skip every row
+PrepareResult parse_limit(Token* token, uint32_t* limit) {
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < token->length; i++) {
+        if (token->start[i] < '0' || token->start[i] > '9') {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if (value < SELECT_NO_LIMIT) {
+            value = value*10 + (token->start[i] - '0');
+        }
+    }
+    *limit = value < SELECT_NO_LIMIT ? value : SELECT_NO_LIMIT;
+    return PREPARE_SUCCESS;
+}
+
+// Parses "join <table> on <id|username|email>" after the table a select is from
+PrepareResult prepare_join(const char** sql, Statement* statement) {
+    Token name, on, column;
+    if (!next_token(sql, &name) || !next_token(sql, &on) || !token_equals(&on, "on")
+            || !next_token(sql, &column)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    statement->joined = true;
+    statement->join_on_id = token_equals(&column, "id");
+    if (!(statement->join_on_id) && !parse_string_column(&column, &(statement->join_column))) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return parse_table_name(&name, statement->join_table_name);
+}
+
+// Parses "select [count(*)] [from <table> [join <table> on <column>]]
+// [where <username|email> <=|like> <value>] [order by <username|email>]
+// [limit <n>] [offset <n>]", where a join takes no where or order by. Like only supports
+// prefix patterns of the form 'prefix%'. Values may be wrapped in single
+// quotes or be a placeholder.
+PrepareResult prepare_select(const char* sql, Statement* statement) {
+    statement->type = STATEMENT_SELECT;
+    statement->filter.type = FILTER_NONE;
+    statement->count_only = false;
+    statement->ordered = false;
+    statement->limit = SELECT_NO_LIMIT;
+    statement->offset = 0;
+    statement->sorter = NULL;
+    statement->joined = false;
+
+    Token keyword, clause;
+    next_token(&sql, &keyword);
+    if (!next_token(&sql, &clause)) {
+        return PREPARE_SUCCESS;
+    }
+    if (token_equals(&clause, "count(*)")) {
+        statement->count_only = true;
+        if (!next_token(&sql, &clause)) {
+            return PREPARE_SUCCESS;
+        }
+    }
+    if (token_equals(&clause, "from")) {
+        Token name;
+        if (!next_token(&sql, &name)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        PrepareResult result = parse_table_name(&name, statement->table_name);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        if (!next_token(&sql, &clause)) {
+            return PREPARE_SUCCESS;
+        }
+        if (token_equals(&clause, "join")) {
+            result = prepare_join(&sql, statement);
+            if (result != PREPARE_SUCCESS) {
+                return result;
+            }
+            if (!next_token(&sql, &clause)) {
+                return PREPARE_SUCCESS;
+            }
+        }
+    }
+    if (token_equals(&clause, "where") && !(statement->joined)) {
+        Token column, operator, value;
+        if (!next_token(&sql, &column) || !next_token(&sql, &operator) || !next_token(&sql, &value)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        PrepareResult result = prepare_where(statement, &column, &operator, &value);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        if (!next_token(&sql, &clause)) {
+            return PREPARE_SUCCESS;
+        }
+    }
+    if (token_equals(&clause, "order") && !(statement->joined)) {
+        Token by, column;
+        if (!next_token(&sql, &by) || !token_equals(&by, "by") || !next_token(&sql, &column)
+                || !parse_string_column(&column, &(statement->order_column))) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->ordered = true;
+        if (!next_token(&sql, &clause)) {
+            return PREPARE_SUCCESS;
+        }
+    }
+    if (token_equals(&clause, "limit")) {
+        Token count;
+        if (!next_token(&sql, &count)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        PrepareResult result = parse_limit(&count, &(statement->limit));
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        if (!next_token(&sql, &clause)) {
+            return PREPARE_SUCCESS;
+        }
+    }
+    if (token_equals(&clause, "offset")) {
+        Token count;
+        if (!next_token(&sql, &count)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        PrepareResult result = parse_limit(&count, &(statement->offset));
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        if (!next_token(&sql, &clause)) {
+            return PREPARE_SUCCESS;
+        }
+    }
+    return PREPARE_SYNTAX_ERROR;
+}
+
+// Parses "explain [analyze] <select>"
+PrepareResult prepare_explain(const char* sql, Statement* statement) {
+    Token keyword, word;
+    next_token(&sql, &keyword);
+    ExplainMode explain = EXPLAIN_PLAN;
+    if (!next_token(&sql, &word)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (token_equals(&word, "analyze")) {
+        explain = EXPLAIN_ANALYZE;
+        if (!next_token(&sql, &word)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+    if (!token_equals(&word, "select")) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    PrepareResult result = prepare_select(word.start, statement);
+    statement->explain = explain;
+    return result;
+}
+
+// Picks the parser for the statement from its first keyword
+PrepareResult prepare_statement_text(const char* sql, Statement* statement) {
+    statement->num_params = 0;
+    statement->bound_params = 0;
+    statement->table_name[0] = '\0';
+    statement->explain = EXPLAIN_NONE;
+    statement->profile = NULL;
+
+    if (strncmp(sql, "insert", 6)==0) {
+        return prepare_insert(sql, statement);
+
+        // The comment below is the previous implementation of insert statement comprehension.
+
+        /*
+        statement->type = STATEMENT_INSERT;
+        // Insert function being scanned
+        int args_assigned = sscanf(
+           input_buffer->buffer, "insert %d %s %s", &(statement->row_to_insert.id),
+           statement->row_to_insert.username, statement->row_to_insert.email);
+        if (args_assigned<3) {
+        return PREPARE_SYNTAX_ERROR;
+        }
+        return PREPARE_SUCCESS;
+        */
+    }
+    if (strncmp(sql, "select", 6)==0 && (sql[6] == '\0' || sql[6] == ' ')) {
+        return prepare_select(sql, statement);
+    }
+    if (strncmp(sql, "explain ", 8)==0) {
+        return prepare_explain(sql, statement);
+    }
+    if (strncmp(sql, "create ", 7)==0) {
+        return prepare_create(sql, statement);
+    }
+    if (strncmp(sql, "drop ", 5)==0) {
+        return prepare_drop(sql, statement);
+    }
+
+    return PREPARE_UNRECOGNISED_STATEMENT;
+}
+
+// Prepares a statement from its text. Values written as "?" are left as
+// parameters to be bound before the statement is executed.
+PrepareResult statement_prepare(const char* sql, Statement* statement) {
+    uint64_t start = stats_clock_ns();
+    PrepareResult result = prepare_statement_text(sql, statement);
+    stats_record_latency(TIMER_PREPARE, start);
+    return result;
+}
+
+// Parameters are numbered from 0 in the order their placeholders appear.
+// Bound values are kept, so a statement can be executed again after rebinding
+// only the parameters that changed.
+PrepareResult statement_bind_id(Statement* statement, uint32_t param, uint64_t id) {
+    if (param >= statement->num_params) {
+        return PREPARE_BAD_PARAMETER;
+    }
+    switch (statement->params[param]) {
+        case (PARAM_TENANT_ID):
+            statement->row_to_insert.tenant_id = id;
+            break;
+        case (PARAM_ID):
+            statement->row_to_insert.id = id;
+            break;
+        case (PARAM_FILTER_TENANT):
+            statement->filter.tenant_id = id;
+            break;
+        default:
+            return PREPARE_BAD_PARAMETER;
+    }
+    statement->bound_params |= 1u << param;
+    return PREPARE_SUCCESS;
+}
+
+PrepareResult statement_bind_text(Statement* statement, uint32_t param, const char* value) {
+    if (param >= statement->num_params) {
+        return PREPARE_BAD_PARAMETER;
+    }
+
+    PrepareResult result;
+    size_t length = strlen(value);
+    switch (statement->params[param]) {
+        case (PARAM_USERNAME):
+            result = copy_column_value(statement->row_to_insert.username, COLUMN_USERNAME_SIZE, value, length);
+            break;
+        case (PARAM_EMAIL):
+            result = copy_column_value(statement->row_to_insert.email, COLUMN_EMAIL_SIZE, value, length);
+            break;
+        case (PARAM_FILTER_VALUE):
+            result = set_filter_value(&(statement->filter), value, length);
+            break;
+        default:
+            return PREPARE_BAD_PARAMETER;
+    }
+
+    if (result == PREPARE_SUCCESS) {
+        statement->bound_params |= 1u << param;
+    }
+    return result;
+}
+
+StatementCache* new_statement_cache() {
+    StatementCache* cache = malloc(sizeof(StatementCache));
+    for (uint32_t i = 0; i < STATEMENT_CACHE_SIZE; i++) {
+        cache->entries[i].sql = NULL;
+    }
+    return cache;
+}
+
+void close_statement_cache(StatementCache* cache) {
+    for (uint32_t i = 0; i < STATEMENT_CACHE_SIZE; i++) {
+        free(cache->entries[i].sql);
+    }
+    free(cache);
+}
+
+// Copies the cached statement for the text into *statement, preparing and
+// caching it on a miss. The copy starts with no parameters bound.
+PrepareResult statement_cache_prepare(StatementCache* cache, const char* sql, Statement* statement) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const char* c = sql; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    StatementCacheEntry* entry = &(cache->entries[hash % STATEMENT_CACHE_SIZE]);
+
+    if (entry->sql == NULL || strcmp(entry->sql, sql) != 0) {
+        PrepareResult result = statement_prepare(sql, statement);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        free(entry->sql);
+        entry->sql = strdup(sql);
+        entry->statement = *statement;
+    }
+
+    *statement = entry->statement;
+    statement->bound_params = 0;
+    return PREPARE_SUCCESS;
+}
+
+// Temporary Insert and  Select statements
+
+#define ROW_FORMAT_INTEGER(name, NAME) ", %" PRIu64
+#define ROW_FORMAT_TEXT(name, NAME, length) ", %s"
+#define ROW_PRINT_ARGUMENT(name, ...) , row->name
+
+// Every column's format starts with a separator, which the first goes without
+#define ROW_COLUMNS_FORMAT ROW_COLUMNS(ROW_FORMAT_INTEGER, ROW_FORMAT_TEXT)
+static const char row_format[] = ROW_COLUMNS_FORMAT ") \n";
+static const char row_columns_format[] = ROW_COLUMNS_FORMAT;
+
+void print_row(Row* row) {
+    putchar('(');
+    printf(row_format + 2 ROW_COLUMNS(ROW_PRINT_ARGUMENT, ROW_PRINT_ARGUMENT));
+}
+
+// Rows of tables keyed by (tenant_id, id) print with their tenant first
+void print_tenant_row(Row* row) {
+    printf("(%" PRIu64, row->tenant_id);
+    printf(row_format ROW_COLUMNS(ROW_PRINT_ARGUMENT, ROW_PRINT_ARGUMENT));
+}
+
+// Prints a row's columns, with its tenant first if it has one, after a
+// separator unless they come first
+void print_row_columns(Row* row, bool with_tenant, bool first) {
+    if (with_tenant) {
+        printf(first ? "%" PRIu64 : ", %" PRIu64, row->tenant_id);
+        first = false;
+    }
+    printf(row_columns_format + (first ? 2 : 0) ROW_COLUMNS(ROW_PRINT_ARGUMENT, ROW_PRINT_ARGUMENT));
+}
+
+// A row of a join is the left table's row followed by the right's
+void print_joined_row(Row* left_row, bool left_tenant, Row* right_row, bool right_tenant) {
+    putchar('(');
+    print_row_columns(left_row, left_tenant, true);
+    print_row_columns(right_row, right_tenant, false);
+    printf(") \n");
+}
+
+// Inserts a row that is already in its struct form, with no statement to parse
+ExecuteResult execute_insert_row (Row* row_to_insert, Table* table) {
+    if (row_to_insert->tenant_id != 0 && !(table->keyed_by_tenant)) {
+        return EXECUTE_KEY_MISMATCH;
+    }
+    uint8_t key[TABLE_KEY_SIZE];
+    row_key(row_to_insert, key);
+    uint8_t value[ROW_SIZE];
+    serialize_row(row_to_insert, value);
+    uint8_t record[ROW_SIZE];
+
+    table_begin_write(table);
+    if (!catalog_read(table->db, table->id, record)) {
+        table_end_write(table);
+        return EXECUTE_NO_TABLE;
+    }
+    // The table's insert also reserves the pages its indexes could split into
+    uint32_t index_pages = 0;
+    for (StringColumn column = 0; column < NUM_STRING_COLUMNS; column++) {
+        uint32_t root_page_num = *catalog_index_root(record, column);
+        if (root_page_num != 0) {
+            index_pages += index_levels(table, column, root_page_num) + 1;
+        }
+    }
+    ExecuteResult result = table_insert(table, key, value, index_pages);
+    if (result == EXECUTE_SUCCESS) {
+        for (StringColumn column = 0; column < NUM_STRING_COLUMNS; column++) {
+            uint32_t root_page_num = *catalog_index_root(record, column);
+            if (root_page_num != 0) {
+                index_insert(table, column, root_page_num, key, value);
+            }
+        }
+    }
+    table_end_write(table);
+    return result;
+}
+
+// Sorting for order by. Each row the select matches becomes a sort record:
+// the column ordered by and the row's key laid out as an index entry, so
+// records compare with one memcmp and rows with the same value come in key
+// order, followed by the row itself. Records collect in memory until they fill
+// the database's sort_memory, then are sorted and spilled to a temporary file
+// as a run. The runs are merged SORT_MERGE_FAN_IN at a time until few enough
+// are left to merge straight into the output. A limit small enough to keep in
+// memory is served instead by a heap of the smallest records seen so far,
+// which never spills.
+#define SORT_MERGE_FAN_IN 16
+#define SORT_RECORD_MAX_SIZE (INDEX_ENTRY_MAX_SIZE + ROW_SIZE)
+
+struct Sorter {
+    StringColumn column;
+    uint32_t key_size;
+    uint32_t record_size;
+    uint32_t limit;
+    bool top_k; // order is a heap of the limit smallest records, largest on top
+    uint8_t* records;
+    uint8_t** order; // the records in memory, in the order they are to be sorted or heaped
+    uint32_t num_records;
+    uint32_t capacity;
+    FILE** runs;
+    uint32_t num_runs;
+    uint32_t runs_capacity;
+};
+
+// The key size of the records being sorted on this thread, for qsort
+_Thread_local uint32_t sorting_key_size;
+
+int compare_sort_records(const void* a, const void* b) {
+    return memcmp(*(uint8_t* const*)a, *(uint8_t* const*)b, sorting_key_size);
+}
+
+void sort_records(uint8_t** order, uint32_t count, uint32_t key_size) {
+    sorting_key_size = key_size;
+    qsort(order, count, sizeof(uint8_t*), compare_sort_records);
+}
+
+// Heaps of sort records, with the smallest on top, or the largest if largest
+bool sort_heap_above(uint8_t* a, uint8_t* b, uint32_t key_size, bool largest) {
+    int compare = memcmp(a, b, key_size);
+    return largest ? compare > 0 : compare < 0;
+}
+
+void sort_heap_swap(uint8_t** heap, uint32_t i, uint32_t j) {
+    uint8_t* record = heap[i];
+    heap[i] = heap[j];
+    heap[j] = record;
+}
+
+void sort_heap_sift_up(uint8_t** heap, uint32_t i, uint32_t key_size, bool largest) {
+    while (i > 0 && sort_heap_above(heap[i], heap[(i - 1)/2], key_size, largest)) {
+        sort_heap_swap(heap, i, (i - 1)/2);
+        i = (i - 1)/2;
+    }
+}
+
+void sort_heap_sift_down(uint8_t** heap, uint32_t count, uint32_t i, uint32_t key_size, bool largest) {
+    while (true) {
+        uint32_t top = i;
+        for (uint32_t child = 2*i + 1; child <= 2*i + 2 && child < count; child++) {
+            if (sort_heap_above(heap[child], heap[top], key_size, largest)) {
+                top = child;
+            }
+        }
+        if (top == i) {
+            return;
+        }
+        sort_heap_swap(heap, i, top);
+        i = top;
+    }
+}
+
+Sorter* sorter_open(Database* db, StringColumn column, uint32_t limit) {
+    Sorter* sorter = malloc(sizeof(Sorter));
+    sorter->column = column;
+    sorter->key_size = index_entry_size(column);
+    sorter->record_size = sorter->key_size + ROW_SIZE;
+    sorter->limit = limit;
+    uint64_t capacity = db->sort_memory/(sorter->record_size + sizeof(uint8_t*));
+    if (capacity < 1) {
+        capacity = 1;
+    }
+    sorter->top_k = limit <= capacity;
+    sorter->capacity = sorter->top_k ? limit : capacity;
+    sorter->records = malloc((size_t)sorter->capacity*sorter->record_size);
+    sorter->order = malloc((size_t)sorter->capacity*sizeof(uint8_t*));
+    sorter->num_records = 0;
+    sorter->runs = NULL;
+    sorter->num_runs = 0;
+    sorter->runs_capacity = 0;
+    return sorter;
+}
+
+void sorter_close(Sorter* sorter) {
+    for (uint32_t i = 0; i < sorter->num_runs; i++) {
+        fclose(sorter->runs[i]);
+    }
+    free(sorter->runs);
+    free(sorter->order);
+    free(sorter->records);
+    free(sorter);
+}
+
+void sort_record_build(Sorter* sorter, const void* value, uint8_t* record) {
+    uint64_t tenant_id, id;
+    memcpy(&tenant_id, value + TENANT_ID_OFFSET, TENANT_ID_SIZE);
+    memcpy(&id, value + ID_OFFSET, ID_SIZE);
+    uint8_t key[TABLE_KEY_SIZE];
+    encode_key(tenant_id, id, key);
+    build_index_entry(sorter->column, value + string_column_offset(sorter->column), key, record);
+    memcpy(record + sorter->key_size, value, ROW_SIZE);
+}
+
+FILE* sort_run_create() {
+    FILE* run = tmpfile();
+    if (run == NULL) {
+        printf("Unable to create a temporary file to sort in: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    return run;
+}
+
+void sort_run_write(Sorter* sorter, FILE* run, uint8_t* record) {
+    if (fwrite(record, sorter->record_size, 1, run) != 1) {
+        printf("Error writing a sorted run: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Returns false at the end of the run
+bool sort_run_read(Sorter* sorter, FILE* run, uint8_t* record) {
+    if (fread(record, sorter->record_size, 1, run) == 1) {
+        return true;
+    }
+    if (ferror(run)) {
+        printf("Error reading a sorted run: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    return false;
+}
+
+void sorter_add_run(Sorter* sorter, FILE* run) {
+    if (sorter->num_runs == sorter->runs_capacity) {
+        sorter->runs_capacity = sorter->runs_capacity == 0 ? SORT_MERGE_FAN_IN : sorter->runs_capacity*2;
+        sorter->runs = realloc(sorter->runs, sorter->runs_capacity*sizeof(FILE*));
+    }
+    sorter->runs[sorter->num_runs++] = run;
+}
+
+// Sorts the records in memory and writes them out as a run
+void sorter_spill(Sorter* sorter) {
+    sort_records(sorter->order, sorter->num_records, sorter->key_size);
+    FILE* run = sort_run_create();
+    for (uint32_t i = 0; i < sorter->num_records; i++) {
+        sort_run_write(sorter, run, sorter->order[i]);
+    }
+    sorter_add_run(sorter, run);
+    sorter->num_records = 0;
+}
+
+void sorter_add(Sorter* sorter, const void* value) {
+    if (sorter->top_k) {
+        if (sorter->limit == 0) {
+            return;
+        }
+        if (sorter->num_records < sorter->limit) {
+            uint8_t* record = sorter->records + (size_t)sorter->num_records*sorter->record_size;
+            sort_record_build(sorter, value, record);
+            sorter->order[sorter->num_records] = record;
+            sort_heap_sift_up(sorter->order, sorter->num_records, sorter->key_size, true);
+            sorter->num_records += 1;
+            return;
+        }
+        // Replaces the largest kept if the row comes before it
+        uint8_t record[SORT_RECORD_MAX_SIZE];
+        sort_record_build(sorter, value, record);
+        if (memcmp(record, sorter->order[0], sorter->key_size) < 0) {
+            memcpy(sorter->order[0], record, sorter->record_size);
+            sort_heap_sift_down(sorter->order, sorter->num_records, 0, sorter->key_size, true);
+        }
+        return;
+    }
+
+    if (sorter->num_records == sorter->capacity) {
+        sorter_spill(sorter);
+    }
+    uint8_t* record = sorter->records + (size_t)sorter->num_records*sorter->record_size;
+    sort_record_build(sorter, value, record);
+    sorter->order[sorter->num_records] = record;
+    sorter->num_records += 1;
+}
+
+bool emit_row(Statement* statement, Table* table, void* value);
+
+// Merges the runs into out, or emits their rows if out is NULL. The head of
+// each run waits in a heap, smallest on top.
+void sorter_merge(Sorter* sorter, FILE** runs, uint32_t num_runs, FILE* out, Statement* statement, Table* table) {
+    uint8_t* heads = malloc((size_t)num_runs*sorter->record_size);
+    uint8_t** heap = malloc(num_runs*sizeof(uint8_t*));
+    uint32_t heap_size = 0;
+    for (uint32_t i = 0; i < num_runs; i++) {
+        rewind(runs[i]);
+        uint8_t* head = heads + (size_t)i*sorter->record_size;
+        if (sort_run_read(sorter, runs[i], head)) {
+            heap[heap_size] = head;
+            sort_heap_sift_up(heap, heap_size, sorter->key_size, false);
+            heap_size++;
+        }
+    }
+
+    while (heap_size > 0 && (out != NULL || statement->num_rows < statement->limit)) {
+        uint8_t* head = heap[0];
+        if (out != NULL) {
+            sort_run_write(sorter, out, head);
+        } else {
+            emit_row(statement, table, head + sorter->key_size);
+        }
+        FILE* run = runs[(head - heads)/sorter->record_size];
+        if (!sort_run_read(sorter, run, head)) {
+            heap[0] = heap[--heap_size];
+        }
+        sort_heap_sift_down(heap, heap_size, 0, sorter->key_size, false);
+    }
+    free(heap);
+    free(heads);
+}
+
+// Emits the rows in order, up to the statement's limit
+void sorter_finish(Sorter* sorter, Statement* statement, Table* table) {
+    if (sorter->num_runs == 0) {
+        sort_records(sorter->order, sorter->num_records, sorter->key_size);
+        for (uint32_t i = 0; i < sorter->num_records && statement->num_rows < statement->limit; i++) {
+            emit_row(statement, table, sorter->order[i] + sorter->key_size);
+        }
+        return;
+    }
+
+    if (sorter->num_records > 0) {
+        sorter_spill(sorter);
+    }
+    while (sorter->num_runs > SORT_MERGE_FAN_IN) {
+        FILE* merged = sort_run_create();
+        sorter_merge(sorter, sorter->runs, SORT_MERGE_FAN_IN, merged, statement, table);
+        for (uint32_t i = 0; i < SORT_MERGE_FAN_IN; i++) {
+            fclose(sorter->runs[i]);
+        }
+        sorter->num_runs -= SORT_MERGE_FAN_IN;
+        memmove(sorter->runs, sorter->runs + SORT_MERGE_FAN_IN, sorter->num_runs*sizeof(FILE*));
+        sorter_add_run(sorter, merged);
+    }
+    sorter_merge(sorter, sorter->runs, sorter->num_runs, NULL, statement, table);
+}
+
+// How a select finds its rows. The same functions pick them whether the
+// select runs or is explained.
+typedef enum {
+    ACCESS_SCAN,
+    ACCESS_PARALLEL_SCAN,
+    ACCESS_TENANT_SEEK,
+    ACCESS_INDEX_LOOKUP,
+    ACCESS_OFFSET_SEEK
+} AccessPath;
+typedef enum { JOIN_MERGE, JOIN_HASH, JOIN_PARTITIONED } JoinMethod;
+
+// A select run by explain analyze prints no rows, and records what it picked
+// and when each step ended
+struct Profile {
+    AccessPath access;
+    uint32_t num_workers; // of a parallel scan
+    JoinMethod join_method;
+    bool build_left;
+    uint32_t num_partitions;
+    uint64_t left_rows; // rows a join read of each table
+    uint64_t right_rows;
+    uint64_t rows_emitted;
+    uint64_t rows_found; // by the access path or join, before any sort or limit
+    uint64_t start_ns;
+    uint64_t built_ns; // a join's side to hash was ready
+    uint64_t partitioned_ns; // and the side to stream, if it was partitioned
+    uint64_t found_ns;
+    uint64_t end_ns;
+};
+
+// True once a select has every row it returns, so the rows left need not be
+// read. Ordered selects and counts take every row they match.
+bool select_done(Statement* statement) {
+    return statement->sorter == NULL && !(statement->count_only) && statement->num_rows >= statement->limit;
+}
+
+// Prints a row the select matched, or for select count(*) only counts it. Rows
+// of an ordered select go to its sorter, which emits them again in order.
+// Rows before the offset or past the limit are skipped. Returns true once the
+// select is done.
+bool emit_row(Statement* statement, Table* table, void* value) {
+    if (statement->profile != NULL) {
+        statement->profile->rows_emitted += 1;
+    }
+    if (statement->sorter != NULL) {
+        sorter_add(statement->sorter, value);
+        return false;
+    }
+    if (!(statement->count_only)) {
+        if (statement->rows_skipped < statement->offset) {
+            statement->rows_skipped += 1;
+            return select_done(statement);
+        }
+        if (statement->num_rows >= statement->limit) {
+            return true;
+        }
+        if (statement->profile == NULL) {
+            Row row;
+            deserialize_row(value, &row);
+            if (table->keyed_by_tenant) {
+                print_tenant_row(&row);
+            } else {
+                print_row(&row);
+            }
+        }
+    }
+    statement->num_rows += 1;
+    return select_done(statement);
+}
+
+// select count(*) returns a single row holding the count. Called once the
+// rows have all been found, before any are sorted.
+void finish_select(Statement* statement) {
+    Profile* profile = statement->profile;
+    if (profile != NULL) {
+        profile->rows_found = statement->count_only ? statement->num_rows : profile->rows_emitted;
+        profile->found_ns = stats_clock_ns();
+    }
+    if (statement->count_only) {
+        if (profile == NULL) {
+            printf("(%d) \n", statement->num_rows);
+        }
+        statement->num_rows = 1;
+    }
+}
+
+// Batches. Unindexed scans work on up to SCAN_BATCH_ROWS rows at a time rather
+// than one: the rows of whole leaves are gathered, and the where clause is
+// applied to them a column at a time, eight bytes of the column at once,
+// narrowing a selection of the rows that pass. count(*) then adds up the
+// selection where a select emits the rows in it. The loops over a batch make
+// no calls and take no branches on the data, so the compiler can vectorise
+// them. A scan's first batch is one leaf and each after it twice as many
+// rows, so a select that stops at its limit reads little past it.
+#define SCAN_BATCH_ROWS 1024
+#define SCAN_BATCH_LANES 16 // a multiple of every vector width
+
+typedef struct {
+    uint32_t num_rows;
+    uint32_t num_selected;
+    uint8_t* values[SCAN_BATCH_ROWS]; // serialized rows, in key order
+    uint16_t selected[SCAN_BATCH_ROWS]; // the rows passing the filter so far
+    uint64_t words[SCAN_BATCH_ROWS]; // eight bytes of a column, for each selected row
+    uint8_t matches[SCAN_BATCH_ROWS];
+} RowBatch;
+
+// Copies length bytes at offset in each selected row into its word
+void batch_gather(RowBatch* batch, uint32_t offset, uint32_t length) {
+    uint32_t num_selected = batch->num_selected;
+    if (length == sizeof(uint64_t)) {
+        for (uint32_t i = 0; i < num_selected; i++) {
+            memcpy(&(batch->words[i]), batch->values[batch->selected[i]] + offset, sizeof(uint64_t));
+        }
+        return;
+    }
+    for (uint32_t i = 0; i < num_selected; i++) {
+        batch->words[i] = 0;
+        memcpy(&(batch->words[i]), batch->values[batch->selected[i]] + offset, length);
+    }
+}
+
+// Keeps the selected rows whose word equals the one given. Words are compared
+// a block of lanes at a time, running past the last selected row to the end of
+// its block, as a loop of a fixed count is one the compiler vectorises without
+// a scalar tail. The halves of the difference are folded together because
+// x86-64 has no 64-bit vector compare before SSE4.1.
+void batch_select_equal(RowBatch* batch, uint64_t word) {
+    uint32_t num_selected = batch->num_selected;
+    uint32_t num_blocks = (num_selected + SCAN_BATCH_LANES - 1)/SCAN_BATCH_LANES;
+    for (uint32_t block = 0; block < num_blocks; block++) {
+        for (uint32_t lane = 0; lane < SCAN_BATCH_LANES; lane++) {
+            uint32_t i = block*SCAN_BATCH_LANES + lane;
+            uint64_t difference = batch->words[i] ^ word;
+            batch->matches[i] = ((uint32_t)difference | (uint32_t)(difference >> 32)) == 0;
+        }
+    }
+    uint32_t num_kept = 0;
+    for (uint32_t i = 0; i < num_selected; i++) {
+        batch->selected[num_kept] = batch->selected[i];
+        num_kept += batch->matches[i];
+    }
+    batch->num_selected = num_kept;
+}
+
+// Selects the rows in the batch that pass the filter. Equality also checks
+// the byte after the value, the null that ends it.
+void batch_filter(RowBatch* batch, Filter* filter) {
+    uint32_t num_blocks = (batch->num_rows + SCAN_BATCH_LANES - 1)/SCAN_BATCH_LANES;
+    for (uint32_t block = 0; block < num_blocks; block++) {
+        for (uint32_t lane = 0; lane < SCAN_BATCH_LANES; lane++) {
+            batch->selected[block*SCAN_BATCH_LANES + lane] = block*SCAN_BATCH_LANES + lane;
+        }
+    }
+    batch->num_selected = batch->num_rows;
+
+    if (filter->type == FILTER_NONE) {
+        return;
+    }
+    if (filter->type == FILTER_TENANT) {
+        batch_gather(batch, TENANT_ID_OFFSET, TENANT_ID_SIZE);
+        batch_select_equal(batch, filter->tenant_id);
+        return;
+    }
+
+    uint8_t pattern[COLUMN_EMAIL_SIZE + 1 + sizeof(uint64_t)] = {0};
+    memcpy(pattern, filter->value, filter->value_length);
+    uint32_t check_length = filter->value_length + (filter->type == FILTER_EQUALS ? 1 : 0);
+    uint32_t column_offset = string_column_offset(filter->column);
+    for (uint32_t offset = 0; offset < check_length && batch->num_selected > 0; offset += sizeof(uint64_t)) {
+        uint32_t length = check_length - offset < sizeof(uint64_t) ? check_length - offset : sizeof(uint64_t);
+        uint64_t word = 0;
+        memcpy(&word, pattern + offset, length);
+        batch_gather(batch, column_offset + offset, length);
+        batch_select_equal(batch, word);
+    }
+}
+
+// Reads the leaves in batches, handing each on to consume once filtered,
+// until consume returns true. Must be called inside a snapshot.
+void scan_batches(Pager* pager, uint32_t* leaf_page_nums, uint32_t num_leaves, Filter* filter,
+                  bool (*consume)(RowBatch* batch, void* arg), void* arg) {
+    RowBatch batch_space;
+    RowBatch* batch = &batch_space;
+    batch->num_rows = 0;
+    uint32_t batch_rows = LEAF_NODE_MAX_CELLS;
+    for (uint32_t leaf = 0; leaf < num_leaves; leaf++) {
+        void* node = get_page(pager, leaf_page_nums[leaf]);
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        if (batch->num_rows > 0 && batch->num_rows + num_cells > batch_rows) {
+            batch_filter(batch, filter);
+            if (consume(batch, arg)) {
+                return;
+            }
+            batch->num_rows = 0;
+            batch_rows = batch_rows*2 < SCAN_BATCH_ROWS ? batch_rows*2 : SCAN_BATCH_ROWS;
+        }
+        for (uint32_t i = 0; i < num_cells; i++) {
+            batch->values[batch->num_rows++] = leaf_node_value(node, i);
+        }
+    }
+    if (batch->num_rows > 0) {
+        batch_filter(batch, filter);
+        consume(batch, arg);
+    }
+}
+
+typedef struct {
+    Statement* statement;
+    Table* table;
+} BatchSelect;
+
+bool emit_batch(RowBatch* batch, void* arg) {
+    BatchSelect* select = arg;
+    select->statement->rows_examined += batch->num_rows;
+    if (select->statement->count_only) {
+        select->statement->num_rows += batch->num_selected;
+        return false;
+    }
+    for (uint32_t i = 0; i < batch->num_selected; i++) {
+        if (emit_row(select->statement, select->table, batch->values[batch->selected[i]])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parallel scans. The table's leaves are split into morsels of
+// SCAN_MORSEL_LEAVES leaves, dealt out in contiguous runs, one per worker.
+// Each worker takes morsels from the front of its own run and, once that is
+// empty, steals from the back of the others'. Workers read the snapshot of the
+// thread that started the scan, which keeps it open until they are done.
+// Matching rows are kept per morsel and printed in table order afterwards;
+// counts are summed.
+#define SCAN_MORSEL_LEAVES 8
+
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t next; // taken by the owner
+    uint32_t end; // stolen by the others
+} MorselQueue;
+
+typedef struct {
+    uint8_t* rows; // serialized
+    uint32_t num_rows;
+    uint32_t capacity;
+} MorselResult;
+
+typedef struct {
+    Table* table;
+    Filter* filter;
+    bool count_only;
+    ThreadSnapshot snapshot;
+    uint32_t leaf_page_nums[TABLE_MAX_PAGES];
+    uint32_t num_leaves;
+    uint32_t num_morsels;
+    uint32_t num_workers;
+    MorselQueue queues[SCAN_MAX_THREADS];
+    MorselResult results[TABLE_MAX_PAGES];
+    uint32_t counts[SCAN_MAX_THREADS];
+    uint32_t examined[SCAN_MAX_THREADS];
+} ParallelScan;
+
+bool scan_take_morsel(ParallelScan* scan, uint32_t worker, uint32_t* morsel) {
+    MorselQueue* queue = &(scan->queues[worker]);
+    pthread_mutex_lock(&(queue->lock));
+    bool found = queue->next < queue->end;
+    if (found) {
+        *morsel = queue->next;
+        queue->next += 1;
+    }
+    pthread_mutex_unlock(&(queue->lock));
+
+    for (uint32_t i = 1; !found && i < scan->num_workers; i++) {
+        queue = &(scan->queues[(worker + i) % scan->num_workers]);
+        pthread_mutex_lock(&(queue->lock));
+        found = queue->next < queue->end;
+        if (found) {
+            queue->end -= 1;
+            *morsel = queue->end;
+        }
+        pthread_mutex_unlock(&(queue->lock));
+    }
+    return found;
+}
+
+typedef struct {
+    ParallelScan* scan;
+    MorselResult* result;
+    uint32_t* count;
+    uint32_t* examined;
+} MorselBatches;
+
+bool keep_morsel_batch(RowBatch* batch, void* arg) {
+    MorselBatches* morsel = arg;
+    *(morsel->count) += batch->num_selected;
+    *(morsel->examined) += batch->num_rows;
+    if (morsel->scan->count_only) {
+        return false;
+    }
+    MorselResult* result = morsel->result;
+    for (uint32_t i = 0; i < batch->num_selected; i++) {
+        if (result->num_rows == result->capacity) {
+            result->capacity = result->capacity == 0 ? LEAF_NODE_MAX_CELLS : result->capacity*2;
+            result->rows = realloc(result->rows, result->capacity*ROW_SIZE);
+        }
+        memcpy(result->rows + result->num_rows*ROW_SIZE, batch->values[batch->selected[i]], ROW_SIZE);
+        result->num_rows += 1;
+    }
+    return false;
+}
+
+void scan_morsel(ParallelScan* scan, uint32_t morsel, uint32_t* count, uint32_t* examined) {
+    uint32_t first_leaf = morsel*SCAN_MORSEL_LEAVES;
+    uint32_t end_leaf = first_leaf + SCAN_MORSEL_LEAVES;
+    if (end_leaf > scan->num_leaves) {
+        end_leaf = scan->num_leaves;
+    }
+    MorselBatches batches = { scan, &(scan->results[morsel]), count, examined };
+    scan_batches(scan->table->pager, scan->leaf_page_nums + first_leaf, end_leaf - first_leaf,
+                 scan->filter, keep_morsel_batch, &batches);
+}
+
+void parallel_scan_worker(void* arg, uint32_t worker) {
+    ParallelScan* scan = arg;
+    if (worker >= scan->num_workers) {
+        return;
+    }
+    if (worker != 0) {
+        reading_snapshot = scan->snapshot;
+    }
+
+    uint32_t count = 0;
+    uint32_t examined = 0;
+    uint32_t morsel;
+    while (scan_take_morsel(scan, worker, &morsel)) {
+        scan_morsel(scan, morsel, &count, &examined);
+    }
+    scan->counts[worker] = count;
+    scan->examined[worker] = examined;
+
+    if (worker != 0) {
+        reading_snapshot.pager = NULL;
+        reading_snapshot.depth = 0;
+    }
+}
+
+// Runs an unindexed select over the given leaves on the database's scan pool.
+// Must be called inside a snapshot.
+ExecuteResult execute_parallel_select(Statement* statement, Table* table, uint32_t* leaf_page_nums, uint32_t num_leaves) {
+    ThreadPool* pool = db_scan_pool(table->db);
+
+    ParallelScan* scan = malloc(sizeof(ParallelScan));
+    scan->table = table;
+    scan->filter = &(statement->filter);
+    scan->count_only = statement->count_only;
+    scan->snapshot = reading_snapshot;
+    memcpy(scan->leaf_page_nums, leaf_page_nums, num_leaves*sizeof(uint32_t));
+    scan->num_leaves = num_leaves;
+    scan->num_morsels = (num_leaves + SCAN_MORSEL_LEAVES - 1)/SCAN_MORSEL_LEAVES;
+    scan->num_workers = pool->num_threads;
+    if (scan->num_workers > scan->num_morsels) {
+        scan->num_workers = scan->num_morsels;
+    }
+
+    for (uint32_t i = 0; i < scan->num_workers; i++) {
+        pthread_mutex_init(&(scan->queues[i].lock), NULL);
+        scan->queues[i].next = i*scan->num_morsels/scan->num_workers;
+        scan->queues[i].end = (i+1)*scan->num_morsels/scan->num_workers;
+        scan->counts[i] = 0;
+    }
+    for (uint32_t i = 0; i < scan->num_morsels; i++) {
+        scan->results[i].rows = NULL;
+        scan->results[i].num_rows = 0;
+        scan->results[i].capacity = 0;
+    }
+
+    thread_pool_run(pool, parallel_scan_worker, scan);
+
+    for (uint32_t i = 0; i < scan->num_workers; i++) {
+        statement->rows_examined += scan->examined[i];
+        if (statement->count_only) {
+            statement->num_rows += scan->counts[i];
+        }
+    }
+    if (statement->profile != NULL) {
+        statement->profile->num_workers = scan->num_workers;
+    }
+    bool done = false;
+    for (uint32_t i = 0; i < scan->num_morsels; i++) {
+        MorselResult* result = &(scan->results[i]);
+        for (uint32_t j = 0; j < result->num_rows && !done; j++) {
+            done = emit_row(statement, table, result->rows + j*ROW_SIZE);
+        }
+        free(result->rows);
+    }
+    for (uint32_t i = 0; i < scan->num_workers; i++) {
+        pthread_mutex_destroy(&(scan->queues[i].lock));
+    }
+    free(scan);
+    finish_select(statement);
+
+    return EXECUTE_SUCCESS;
+}
+
+// Answers a filtered select from the index on the filtered column. Entries are
+// read from the first one not less than the value for as long as they match,
+// and each id is then looked up in the table.
+ExecuteResult execute_index_select(Statement* statement, Table* table, uint32_t root_page_num) {
+    Filter* filter = &(statement->filter);
+    StringColumn column = filter->column;
+    uint8_t entry[INDEX_ENTRY_MAX_SIZE];
+    uint8_t first_key[TABLE_KEY_SIZE] = {0};
+    build_index_entry(column, filter->value, first_key, entry);
+
+    IndexCursor index_cursor;
+    index_seek(table, column, root_page_num, entry, &index_cursor);
+
+    bool done = false;
+    while (!(index_cursor.end_of_index) && !done) {
+        const char* key = index_cursor_entry(&index_cursor);
+        if (memcmp(key, filter->value, filter->value_length) != 0
+                || (filter->type == FILTER_EQUALS && key[filter->value_length] != '\0')) {
+            break;
+        }
+        statement->rows_examined += 1;
+
+        void* value = table_find_value(table, key + string_column_size(column));
+        if (value != NULL) {
+            done = emit_row(statement, table, value);
+        }
+
+        index_cursor_advance(&index_cursor);
+    }
+    index_cursor_close(&index_cursor);
+    finish_select(statement);
+
+    return EXECUTE_SUCCESS;
+}
+
+// Answers a select on one tenant. Its rows are the keys that start with the
+// tenant, so they lie together in key order: the scan seeks to the first and
+// stops at the first row of the next tenant.
+ExecuteResult execute_tenant_select(Statement* statement, Table* table) {
+    uint64_t tenant_id = statement->filter.tenant_id;
+    uint8_t first_key[TABLE_KEY_SIZE];
+    encode_key(tenant_id, 0, first_key);
+
+    Cursor cursor;
+    table_find_cursor(table, first_key, &cursor);
+    bool done = false;
+    while (!(cursor.end_of_table) && key_tenant_id(cursor_key(&cursor)) == tenant_id && !done) {
+        statement->rows_examined += 1;
+        done = emit_row(statement, table, cursor_value(&cursor));
+        cursor_advance(&cursor);
+    }
+    cursor_close(&cursor);
+    finish_select(statement);
+
+    return EXECUTE_SUCCESS;
+}
+
+// Answers a select of every row from an offset by seeking straight to the row
+// at the offset, rather than reading past the rows before it
+ExecuteResult execute_offset_select(Statement* statement, Table* table) {
+    Cursor cursor;
+    table_offset_cursor(table, statement->offset, &cursor);
+    statement->rows_skipped = statement->offset;
+    bool done = select_done(statement);
+    while (!(cursor.end_of_table) && !done) {
+        statement->rows_examined += 1;
+        done = emit_row(statement, table, cursor_value(&cursor));
+        cursor_advance(&cursor);
+    }
+    cursor_close(&cursor);
+    finish_select(statement);
+
+    return EXECUTE_SUCCESS;
+}
+
+// Picks how a select finds its rows: by seeking to its tenant's, by looking
+// up the index on the column it filters, by seeking to the row at its offset
+// if every row is wanted in key order, or by scanning the leaves, which are
+// then listed for it. Scans of tables with more than one morsel of leaves run
+// in parallel, unless a limit can stop them early. Must be called inside a
+// snapshot.
+AccessPath select_access_path(Statement* statement, Table* table, void* record,
+                              uint32_t* leaf_page_nums, uint32_t* num_leaves) {
+    Filter* filter = &(statement->filter);
+    if (filter->type == FILTER_NONE && statement->offset > 0 && !(statement->ordered)
+            && !(statement->count_only)) {
+        return ACCESS_OFFSET_SEEK;
+    }
+    if (filter->type == FILTER_TENANT) {
+        return ACCESS_TENANT_SEEK;
+    }
+    if (filter->type != FILTER_NONE && *catalog_index_root(record, filter->column) != 0) {
+        return ACCESS_INDEX_LOOKUP;
+    }
+    *num_leaves = table_leaf_pages(table, leaf_page_nums);
+    bool limited = statement->limit != SELECT_NO_LIMIT && !(statement->ordered) && !(statement->count_only);
+    if (table->db->scan_threads > 1 && *num_leaves > SCAN_MORSEL_LEAVES && !limited) {
+        return ACCESS_PARALLEL_SCAN;
+    }
+    return ACCESS_SCAN;
+}
+
+// The whole select reads one snapshot, so it neither waits for the writer nor
+// holds it up, and sees none of the rows inserted while it runs. Ordered
+// selects sort the rows whichever way they were found.
+ExecuteResult execute_select (Statement* statement, Table* table) {
+    pager_begin_snapshot(table->pager);
+    ExecuteResult result = EXECUTE_SUCCESS;
+    uint32_t leaf_page_nums[TABLE_MAX_PAGES];
+    uint8_t record[ROW_SIZE];
+    Sorter* sorter = NULL;
+    if (statement->ordered && !(statement->count_only)) {
+        uint64_t keep = (uint64_t)statement->limit + statement->offset;
+        sorter = sorter_open(table->db, statement->order_column, keep < SELECT_NO_LIMIT ? keep : SELECT_NO_LIMIT);
+        statement->sorter = sorter;
+    }
+
+    if (!catalog_read(table->db, table->id, record)) {
+        result = EXECUTE_NO_TABLE;
+    } else {
+        uint32_t num_leaves = 0;
+        AccessPath access = select_access_path(statement, table, record, leaf_page_nums, &num_leaves);
+        if (statement->profile != NULL) {
+            statement->profile->access = access;
+        }
+        switch (access) {
+            case (ACCESS_TENANT_SEEK):
+                result = execute_tenant_select(statement, table);
+                break;
+            case (ACCESS_INDEX_LOOKUP):
+                result = execute_index_select(statement, table, *catalog_index_root(record, statement->filter.column));
+                break;
+            case (ACCESS_OFFSET_SEEK):
+                result = execute_offset_select(statement, table);
+                break;
+            case (ACCESS_PARALLEL_SCAN):
+                result = execute_parallel_select(statement, table, leaf_page_nums, num_leaves);
+                break;
+            case (ACCESS_SCAN): {
+                BatchSelect select = { statement, table };
+                scan_batches(table->pager, leaf_page_nums, num_leaves, &(statement->filter), emit_batch, &select);
+                finish_select(statement);
+                break;
+            }
+        }
+    }
+    if (sorter != NULL) {
+        statement->sorter = NULL;
+        if (result == EXECUTE_SUCCESS) {
+            sorter_finish(sorter, statement, table);
+        }
+        sorter_close(sorter);
+    }
+
+    pager_end_snapshot(table->pager);
+    return result;
+}
+
+// Joins. "select from <left> join <right> on <column>" returns a row for each
+// pair of rows, one from each table, holding the same value in the column.
+// A join on id between two tables keyed alike joins on the whole key, so two
+// tables keyed by (tenant_id, id) pair rows only within a tenant; a table
+// keyed by id alone has no tenant, and its rows pair with any tenant's. Both
+// tables of a join on their whole key are read in key order, so they are
+// merged: a cursor on each advances past the smaller key until the two meet.
+// Other joins hash. The rows of the side with fewer rows are read
+// into a hash table on the column, and a cursor on the other side streams
+// past, looking each of its rows up. When the smaller side would take more
+// than the database's join_memory, both sides are first split by hash into
+// partitions in temporary files, and each pair of partitions is then joined
+// in memory on its own. Merged and hashed joins return rows in the key order
+// of the side streamed, partitioned ones partition by partition.
+#define JOIN_MAX_PARTITIONS 64
+
+_Static_assert(TENANT_ID_OFFSET + TENANT_ID_SIZE == ID_OFFSET, "a row's key must be stored whole");
+
+typedef struct {
+    Statement* statement;
+    Table* left;
+    Table* right;
+    JoinMethod method;
+    bool build_left; // the left side is hashed and the right streamed
+    uint32_t num_partitions; // of a partitioned join
+    uint32_t key_offset;
+    uint32_t key_size; // bytes the value can take
+    bool key_text; // the value ends at its null
+    uint32_t left_leaves[TABLE_MAX_PAGES]; // not listed for a merge
+    uint32_t right_leaves[TABLE_MAX_PAGES];
+    uint32_t num_left_leaves;
+    uint32_t num_right_leaves;
+    uint32_t num_left_rows;
+    uint32_t num_right_rows;
+    uint32_t left_rows_read;
+    uint32_t right_rows_read;
+    uint64_t built_ns; // when the side hashed was ready
+    uint64_t partitioned_ns; // and the side streamed, for a partitioned join
+} Join;
+
+// The rows of the side hashed. Rows in the same bucket are chained in the
+// order they were added.
+typedef struct {
+    uint8_t* rows; // serialized
+    uint64_t* hashes;
+    uint32_t* next; // the next row in the bucket plus one, or 0
+    uint32_t* buckets; // the first row in each plus one, or 0
+    uint32_t bucket_mask;
+    uint32_t num_rows;
+} JoinHash;
+
+// What a row costs in a join's hash table
+#define JOIN_ROW_BYTES (ROW_SIZE + sizeof(uint64_t) + 2*sizeof(uint32_t))
+
+uint32_t join_key_length(Join* join, const uint8_t* value) {
+    if (!(join->key_text)) {
+        return join->key_size;
+    }
+    return strnlen((const char*)value + join->key_offset, join->key_size);
+}
+
+// FNV-1a over the value
+uint64_t join_hash_value(Join* join, const uint8_t* value) {
+    const uint8_t* key = value + join->key_offset;
+    uint32_t length = join_key_length(join, value);
+    uint64_t hash = 14695981039346656037ull;
+    for (uint32_t i = 0; i < length; i++) {
+        hash = (hash ^ key[i])*1099511628211ull;
+    }
+    return hash;
+}
+
+bool join_keys_equal(Join* join, const uint8_t* a, const uint8_t* b) {
+    uint32_t length = join_key_length(join, a);
+    return length == join_key_length(join, b)
+        && memcmp(a + join->key_offset, b + join->key_offset, length) == 0;
+}
+
+// Rows past the limit are not wanted, unless they are being counted
+bool join_wants_rows(Statement* statement) {
+    return statement->count_only || statement->num_rows < statement->limit;
+}
+
+void emit_joined(Join* join, const uint8_t* build_value, const uint8_t* probe_value) {
+    Statement* statement = join->statement;
+    if (statement->profile != NULL) {
+        statement->profile->rows_emitted += 1;
+    }
+    if (!(statement->count_only)) {
+        if (statement->rows_skipped < statement->offset) {
+            statement->rows_skipped += 1;
+            return;
+        }
+        if (statement->num_rows >= statement->limit) {
+            return;
+        }
+        if (statement->profile == NULL) {
+            Row left_row, right_row;
+            deserialize_row((void*)(join->build_left ? build_value : probe_value), &left_row);
+            deserialize_row((void*)(join->build_left ? probe_value : build_value), &right_row);
+            print_joined_row(&left_row, join->left->keyed_by_tenant, &right_row, join->right->keyed_by_tenant);
+        }
+    }
+    statement->num_rows += 1;
+}
+
+void join_merge(Join* join) {
+    Cursor left_cursor, right_cursor;
+    table_start_cursor(join->left, &left_cursor);
+    table_start_cursor(join->right, &right_cursor);
+    join->left_rows_read = !(left_cursor.end_of_table);
+    join->right_rows_read = !(right_cursor.end_of_table);
+    while (!(left_cursor.end_of_table) && !(right_cursor.end_of_table)
+            && join_wants_rows(join->statement)) {
+        int compare = compare_keys(cursor_key(&left_cursor), cursor_key(&right_cursor));
+        if (compare == 0) {
+            emit_joined(join, cursor_value(&left_cursor), cursor_value(&right_cursor));
+        }
+        if (compare <= 0) {
+            cursor_advance(&left_cursor);
+            join->left_rows_read += !(left_cursor.end_of_table);
+        }
+        if (compare >= 0) {
+            cursor_advance(&right_cursor);
+            join->right_rows_read += !(right_cursor.end_of_table);
+        }
+    }
+    cursor_close(&right_cursor);
+    cursor_close(&left_cursor);
+}
+
+void join_hash_open(JoinHash* hash, uint32_t capacity) {
+    hash->rows = malloc((size_t)capacity*ROW_SIZE);
+    hash->hashes = malloc((size_t)capacity*sizeof(uint64_t));
+    hash->next = malloc((size_t)capacity*sizeof(uint32_t));
+    uint32_t num_buckets = 1;
+    while (num_buckets < capacity) {
+        num_buckets *= 2;
+    }
+    hash->buckets = calloc(num_buckets, sizeof(uint32_t));
+    hash->bucket_mask = num_buckets - 1;
+    hash->num_rows = 0;
+}
+
+void join_hash_close(JoinHash* hash) {
+    free(hash->buckets);
+    free(hash->next);
+    free(hash->hashes);
+    free(hash->rows);
+}
+
+// The table must have room for the row
+void join_hash_add(Join* join, JoinHash* hash, const uint8_t* value) {
+    memcpy(hash->rows + (size_t)hash->num_rows*ROW_SIZE, value, ROW_SIZE);
+    hash->hashes[hash->num_rows] = join_hash_value(join, value);
+    hash->num_rows += 1;
+}
+
+// Chains the rows into their buckets once they have all been added. Rows are
+// pushed onto the front of their chains last first, leaving each chain in
+// the order its rows were added.
+void join_hash_link(JoinHash* hash) {
+    for (uint32_t i = hash->num_rows; i > 0; i--) {
+        uint32_t* bucket = &(hash->buckets[hash->hashes[i - 1] & hash->bucket_mask]);
+        hash->next[i - 1] = *bucket;
+        *bucket = i;
+    }
+}
+
+void join_probe(Join* join, JoinHash* hash, const uint8_t* value) {
+    uint64_t value_hash = join_hash_value(join, value);
+    for (uint32_t i = hash->buckets[value_hash & hash->bucket_mask]; i != 0; i = hash->next[i - 1]) {
+        const uint8_t* row = hash->rows + (size_t)(i - 1)*ROW_SIZE;
+        if (hash->hashes[i - 1] == value_hash && join_keys_equal(join, row, value)) {
+            emit_joined(join, row, value);
+        }
+    }
+}
+
+typedef struct {
+    Join* join;
+    JoinHash* hash;
+} JoinBuild;
+
+bool join_build_batch(RowBatch* batch, void* arg) {
+    JoinBuild* build = arg;
+    for (uint32_t i = 0; i < batch->num_selected; i++) {
+        join_hash_add(build->join, build->hash, batch->values[batch->selected[i]]);
+    }
+    return false;
+}
+
+void join_in_memory(Join* join) {
+    Table* probe = join->build_left ? join->right : join->left;
+    uint32_t num_build_rows = join->build_left ? join->num_left_rows : join->num_right_rows;
+    JoinHash hash;
+    join_hash_open(&hash, num_build_rows);
+    JoinBuild build = { join, &hash };
+    Filter all = { .type = FILTER_NONE };
+    scan_batches(join->left->pager, join->build_left ? join->left_leaves : join->right_leaves,
+                 join->build_left ? join->num_left_leaves : join->num_right_leaves, &all, join_build_batch, &build);
+    join_hash_link(&hash);
+    join->built_ns = stats_clock_ns();
+    join->partitioned_ns = join->built_ns;
+
+    uint32_t num_probe_rows = 0;
+    Cursor cursor;
+    table_start_cursor(probe, &cursor);
+    while (!(cursor.end_of_table) && join_wants_rows(join->statement)) {
+        join_probe(join, &hash, cursor_value(&cursor));
+        num_probe_rows += 1;
+        cursor_advance(&cursor);
+    }
+    cursor_close(&cursor);
+    join_hash_close(&hash);
+    join->left_rows_read = join->build_left ? num_build_rows : num_probe_rows;
+    join->right_rows_read = join->build_left ? num_probe_rows : num_build_rows;
+}
+
+FILE* join_partition_create() {
+    FILE* partition = tmpfile();
+    if (partition == NULL) {
+        printf("Unable to create a temporary file to join in: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    return partition;
+}
+
+void join_partition_write(FILE* partition, const uint8_t* value) {
+    if (fwrite(value, ROW_SIZE, 1, partition) != 1) {
+        printf("Error writing a join partition: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Returns false at the end of the partition
+bool join_partition_read(FILE* partition, uint8_t* value) {
+    if (fread(value, ROW_SIZE, 1, partition) == 1) {
+        return true;
+    }
+    if (ferror(partition)) {
+        printf("Error reading a join partition: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    return false;
+}
+
+typedef struct {
+    Join* join;
+    FILE** partitions;
+    uint32_t num_partitions;
+} JoinPartitions;
+
+// Partitions by the top half of the hash, as buckets are picked by the bottom
+bool join_partition_batch(RowBatch* batch, void* arg) {
+    JoinPartitions* partitions = arg;
+    for (uint32_t i = 0; i < batch->num_selected; i++) {
+        const uint8_t* value = batch->values[batch->selected[i]];
+        uint64_t hash = join_hash_value(partitions->join, value);
+        join_partition_write(partitions->partitions[(hash >> 32) % partitions->num_partitions], value);
+    }
+    return false;
+}
+
+void join_partitioned(Join* join) {
+    Pager* pager = join->left->pager;
+    uint32_t num_partitions = join->num_partitions;
+    FILE* build_files[JOIN_MAX_PARTITIONS];
+    FILE* probe_files[JOIN_MAX_PARTITIONS];
+    for (uint32_t i = 0; i < num_partitions; i++) {
+        build_files[i] = join_partition_create();
+        probe_files[i] = join_partition_create();
+    }
+    Filter all = { .type = FILTER_NONE };
+    JoinPartitions build = { join, build_files, num_partitions };
+    scan_batches(pager, join->build_left ? join->left_leaves : join->right_leaves,
+                 join->build_left ? join->num_left_leaves : join->num_right_leaves, &all, join_partition_batch, &build);
+    join->built_ns = stats_clock_ns();
+    JoinPartitions probe = { join, probe_files, num_partitions };
+    scan_batches(pager, join->build_left ? join->right_leaves : join->left_leaves,
+                 join->build_left ? join->num_right_leaves : join->num_left_leaves, &all, join_partition_batch, &probe);
+    join->partitioned_ns = stats_clock_ns();
+    join->left_rows_read = join->num_left_rows;
+    join->right_rows_read = join->num_right_rows;
+
+    uint8_t value[ROW_SIZE];
+    for (uint32_t i = 0; i < num_partitions && join_wants_rows(join->statement); i++) {
+        uint32_t num_rows = ftell(build_files[i])/ROW_SIZE;
+        if (num_rows == 0) {
+            continue;
+        }
+        JoinHash hash;
+        join_hash_open(&hash, num_rows);
+        rewind(build_files[i]);
+        while (join_partition_read(build_files[i], value)) {
+            join_hash_add(join, &hash, value);
+        }
+        join_hash_link(&hash);
+
+        rewind(probe_files[i]);
+        while (join_wants_rows(join->statement) && join_partition_read(probe_files[i], value)) {
+            join_probe(join, &hash, value);
+        }
+        join_hash_close(&hash);
+    }
+    for (uint32_t i = 0; i < num_partitions; i++) {
+        fclose(build_files[i]);
+        fclose(probe_files[i]);
+    }
+}
+
+uint32_t count_leaf_rows(Pager* pager, uint32_t* leaf_page_nums, uint32_t num_leaves) {
+    uint32_t num_rows = 0;
+    for (uint32_t i = 0; i < num_leaves; i++) {
+        num_rows += *leaf_node_num_cells(get_page(pager, leaf_page_nums[i]));
+    }
+    return num_rows;
+}
+
+// Picks how to join the tables: merging two tables keyed alike on their key,
+// or else hashing the side with fewer rows, in memory if it fits. Must be
+// called inside a snapshot.
+ExecuteResult join_plan(Statement* statement, Table* left, Join* join) {
+    Table* right = db_table(left, statement->join_table_name);
+    uint8_t record[ROW_SIZE];
+    if (right == NULL || !catalog_read(left->db, left->id, record) || !catalog_read(right->db, right->id, record)) {
+        return EXECUTE_NO_TABLE;
+    }
+    join->statement = statement;
+    join->left = left;
+    join->right = right;
+    join->build_left = true;
+    join->num_partitions = 0;
+    join->left_rows_read = 0;
+    join->right_rows_read = 0;
+    bool same_keys = left->keyed_by_tenant == right->keyed_by_tenant;
+    if (statement->join_on_id && same_keys) {
+        // The whole key, so that tenants keep to their own rows
+        join->key_offset = TENANT_ID_OFFSET;
+        join->key_size = TENANT_ID_SIZE + ID_SIZE;
+        join->key_text = false;
+    } else if (statement->join_on_id) {
+        join->key_offset = ID_OFFSET;
+        join->key_size = ID_SIZE;
+        join->key_text = false;
+    } else {
+        join->key_offset = string_column_offset(statement->join_column);
+        join->key_size = string_column_size(statement->join_column);
+        join->key_text = true;
+    }
+
+    if (statement->join_on_id && same_keys) {
+        join->method = JOIN_MERGE;
+        return EXECUTE_SUCCESS;
+    }
+    join->num_left_leaves = table_leaf_pages(left, join->left_leaves);
+    join->num_right_leaves = table_leaf_pages(right, join->right_leaves);
+    join->num_left_rows = count_leaf_rows(left->pager, join->left_leaves, join->num_left_leaves);
+    join->num_right_rows = count_leaf_rows(right->pager, join->right_leaves, join->num_right_leaves);
+    join->build_left = join->num_left_rows <= join->num_right_rows;
+
+    uint64_t build_bytes = (uint64_t)(join->build_left ? join->num_left_rows : join->num_right_rows)*JOIN_ROW_BYTES;
+    if (build_bytes <= left->db->join_memory) {
+        join->method = JOIN_HASH;
+        return EXECUTE_SUCCESS;
+    }
+    // Enough partitions that each of the side hashed should fit in memory
+    join->method = JOIN_PARTITIONED;
+    uint64_t num_partitions = build_bytes/left->db->join_memory + 1;
+    if (num_partitions < 2) {
+        num_partitions = 2;
+    }
+    join->num_partitions = num_partitions < JOIN_MAX_PARTITIONS ? num_partitions : JOIN_MAX_PARTITIONS;
+    return EXECUTE_SUCCESS;
+}
+
+// The join reads one snapshot of both tables, as a select does
+ExecuteResult execute_join(Statement* statement, Table* left) {
+    pager_begin_snapshot(left->pager);
+    Join* join = malloc(sizeof(Join));
+    ExecuteResult result = join_plan(statement, left, join);
+    if (result == EXECUTE_SUCCESS) {
+        join->built_ns = stats_clock_ns();
+        join->partitioned_ns = join->built_ns;
+        switch (join->method) {
+            case (JOIN_MERGE):
+                join_merge(join);
+                break;
+            case (JOIN_HASH):
+                join_in_memory(join);
+                break;
+            case (JOIN_PARTITIONED):
+                join_partitioned(join);
+                break;
+        }
+        statement->rows_examined = join->left_rows_read + join->right_rows_read;
+        Profile* profile = statement->profile;
+        if (profile != NULL) {
+            profile->join_method = join->method;
+            profile->build_left = join->build_left;
+            profile->num_partitions = join->num_partitions;
+            profile->left_rows = join->left_rows_read;
+            profile->right_rows = join->right_rows_read;
+            profile->built_ns = join->built_ns;
+            profile->partitioned_ns = join->partitioned_ns;
+        }
+        finish_select(statement);
+    }
+    free(join);
+    pager_end_snapshot(left->pager);
+    return result;
+}
+
+// Explain. The plan prints as a tree of the steps a select takes, the step
+// returning its rows first with the steps feeding it indented below. Explain
+// analyze follows each step with the rows it produced and the time spent in
+// it alone, and the plan with the pages the select looked up in the cache,
+// the rows it examined and returned, and its time. Pages are counted across
+// the database, so reads by other threads while it runs are counted too.
+
+// Fills in the plan a select would run by, without running it
+ExecuteResult explain_plan(Statement* statement, Table* table, Profile* profile) {
+    pager_begin_snapshot(table->pager);
+    ExecuteResult result = EXECUTE_SUCCESS;
+    uint8_t record[ROW_SIZE];
+    if (statement->joined) {
+        Join* join = malloc(sizeof(Join));
+        result = join_plan(statement, table, join);
+        if (result == EXECUTE_SUCCESS) {
+            profile->join_method = join->method;
+            profile->build_left = join->build_left;
+            profile->num_partitions = join->num_partitions;
+        }
+        free(join);
+    } else if (!catalog_read(table->db, table->id, record)) {
+        result = EXECUTE_NO_TABLE;
+    } else {
+        uint32_t leaf_page_nums[TABLE_MAX_PAGES];
+        uint32_t num_leaves = 0;
+        profile->access = select_access_path(statement, table, record, leaf_page_nums, &num_leaves);
+        uint32_t num_morsels = (num_leaves + SCAN_MORSEL_LEAVES - 1)/SCAN_MORSEL_LEAVES;
+        profile->num_workers = db_scan_threads(table->db);
+        if (profile->num_workers > num_morsels) {
+            profile->num_workers = num_morsels;
+        }
+    }
+    pager_end_snapshot(table->pager);
+    return result;
+}
+
+void print_filter(Filter* filter) {
+    switch (filter->type) {
+        case (FILTER_NONE):
+            break;
+        case (FILTER_TENANT):
+            printf(" where tenant_id = %" PRIu64, filter->tenant_id);
+            break;
+        case (FILTER_EQUALS):
+            printf(" where %s = '%s'", string_column_names[filter->column], filter->value);
+            break;
+        case (FILTER_PREFIX):
+            printf(" where %s like '%s%%'", string_column_names[filter->column], filter->value);
+            break;
+    }
+}
+
+// Ends a step's line, with its rows and time if analyzed
+void print_step_end(Statement* statement, uint64_t rows, uint64_t start_ns, uint64_t end_ns) {
+    if (statement->explain == EXPLAIN_ANALYZE) {
+        printf(" (rows %llu", (unsigned long long)rows);
+        if (end_ns != 0) {
+            printf(", %.3f ms", (end_ns - start_ns)/1e6);
+        }
+        printf(")");
+    }
+    printf("\n");
+}
+
+void print_plan(Statement* statement, Table* table, Profile* profile) {
+    uint32_t depth = 0;
+    if (statement->count_only) {
+        printf("count");
+        print_step_end(statement, 1, 0, 0);
+        depth++;
+    } else if (statement->ordered && !(statement->joined)) {
+        printf("sort by %s", string_column_names[statement->order_column]);
+        if (statement->limit != SELECT_NO_LIMIT) {
+            printf(", keeping %u", statement->limit);
+        }
+        if (statement->offset > 0) {
+            printf(" after %u", statement->offset);
+        }
+        print_step_end(statement, statement->num_rows, profile->found_ns, profile->end_ns);
+        depth++;
+    } else if (statement->limit != SELECT_NO_LIMIT || statement->offset > 0) {
+        if (statement->limit != SELECT_NO_LIMIT) {
+            printf("limit %u%s", statement->limit, statement->offset > 0 ? ", " : "");
+        }
+        if (statement->offset > 0) {
+            printf("offset %u", statement->offset);
+        }
+        print_step_end(statement, statement->num_rows, 0, 0);
+        depth++;
+    }
+    printf("%*s", 2*depth, "");
+
+    if (!(statement->joined)) {
+        switch (profile->access) {
+            case (ACCESS_SCAN):
+                printf("scan %s", table->name);
+                print_filter(&(statement->filter));
+                break;
+            case (ACCESS_PARALLEL_SCAN):
+                printf("parallel scan %s on %u threads", table->name, profile->num_workers);
+                print_filter(&(statement->filter));
+                break;
+            case (ACCESS_TENANT_SEEK):
+                printf("key seek %s", table->name);
+                print_filter(&(statement->filter));
+                break;
+            case (ACCESS_INDEX_LOOKUP):
+                printf("index lookup %s", table->name);
+                print_filter(&(statement->filter));
+                break;
+            case (ACCESS_OFFSET_SEEK):
+                printf("offset seek %s to row %u", table->name, statement->offset);
+                break;
+        }
+        if (statement->explain == EXPLAIN_ANALYZE) {
+            printf(" (rows %llu of %u examined, %.3f ms)\n", (unsigned long long)profile->rows_found,
+                   statement->rows_examined, (profile->found_ns - profile->start_ns)/1e6);
+        } else {
+            printf("\n");
+        }
+        return;
+    }
+
+    const char* on = statement->join_on_id ? "id" : string_column_names[statement->join_column];
+    const char* left_name = table->name;
+    const char* right_name = statement->join_table_name;
+    const char* build_name = profile->build_left ? left_name : right_name;
+    const char* probe_name = profile->build_left ? right_name : left_name;
+    uint64_t build_rows = profile->build_left ? profile->left_rows : profile->right_rows;
+    uint64_t probe_rows = profile->build_left ? profile->right_rows : profile->left_rows;
+    switch (profile->join_method) {
+        case (JOIN_MERGE):
+            printf("merge join on %s", on);
+            print_step_end(statement, profile->rows_found, profile->partitioned_ns, profile->found_ns);
+            printf("%*sscan %s", 2*depth + 2, "", left_name);
+            print_step_end(statement, profile->left_rows, 0, 0);
+            printf("%*sscan %s", 2*depth + 2, "", right_name);
+            print_step_end(statement, profile->right_rows, 0, 0);
+            break;
+        case (JOIN_HASH):
+            printf("hash join on %s", on);
+            print_step_end(statement, profile->rows_found, profile->partitioned_ns, profile->found_ns);
+            printf("%*shash %s", 2*depth + 2, "", build_name);
+            print_step_end(statement, build_rows, profile->start_ns, profile->built_ns);
+            printf("%*sscan %s", 2*depth + 2, "", probe_name);
+            print_step_end(statement, probe_rows, 0, 0);
+            break;
+        case (JOIN_PARTITIONED):
+            printf("partitioned hash join on %s, %u partitions", on, profile->num_partitions);
+            print_step_end(statement, profile->rows_found, profile->partitioned_ns, profile->found_ns);
+            printf("%*spartition %s", 2*depth + 2, "", build_name);
+            print_step_end(statement, build_rows, profile->start_ns, profile->built_ns);
+            printf("%*spartition %s", 2*depth + 2, "", probe_name);
+            print_step_end(statement, probe_rows, profile->built_ns, profile->partitioned_ns);
+            break;
+    }
+}
+
+// Explain prints the plan, and explain analyze runs the select to measure it
+ExecuteResult execute_explain(Statement* statement, Table* table) {
+    Profile profile;
+    memset(&profile, 0, sizeof(profile));
+    DbStats before, after;
+    ExecuteResult result;
+    if (statement->explain == EXPLAIN_PLAN) {
+        result = explain_plan(statement, table, &profile);
+    } else {
+        db_stats(&before);
+        statement->profile = &profile;
+        profile.start_ns = stats_clock_ns();
+        result = statement->joined ? execute_join(statement, table) : execute_select(statement, table);
+        profile.end_ns = stats_clock_ns();
+        statement->profile = NULL;
+        db_stats(&after);
+    }
+    if (result != EXECUTE_SUCCESS) {
+        return result;
+    }
+
+    print_plan(statement, table, &profile);
+    if (statement->explain == EXPLAIN_ANALYZE) {
+        printf("pages: %llu hits, %llu misses, %llu read ahead\n",
+               (unsigned long long)(after.page_hits - before.page_hits),
+               (unsigned long long)(after.page_misses - before.page_misses),
+               (unsigned long long)(after.pages_read_ahead - before.pages_read_ahead));
+        printf("rows: %u examined, %u returned\n", statement->rows_examined, statement->num_rows);
+        printf("time: %.3f ms\n", (profile.end_ns - profile.start_ns)/1e6);
+    }
+    statement->num_rows = 0;
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult execute_create_index (Statement* statement, Table* table) {
+    ExecuteResult result = EXECUTE_SUCCESS;
+    uint8_t record[ROW_SIZE];
+    table_begin_write(table);
+    if (!catalog_read(table->db, table->id, record)) {
+        result = EXECUTE_NO_TABLE;
+    } else if (*catalog_index_root(record, statement->index_column) != 0) {
+        result = EXECUTE_INDEX_EXISTS;
+    } else if (index_create_pages(table, statement->index_column) > pager_pages_available(table->pager)) {
+        result = EXECUTE_TABLE_FULL;
+    } else {
+        index_create(table, statement->index_column, record);
+    }
+    table_end_write(table);
+    return result;
+}
+
+ExecuteResult execute_create_table (Statement* statement, Table* table) {
+    table_begin_write(table);
+    ExecuteResult result = catalog_create_table(table->db, statement->table_name, statement->with_tenant);
+    table_end_write(table);
+    return result;
+}
+
+ExecuteResult execute_drop_table (Statement* statement, Table* table) {
+    table_begin_write(table);
+    ExecuteResult result = catalog_drop_table(table->db, statement->table_name);
+    table_end_write(table);
+    return result;
+}
+
+ExecuteResult execute_insert (Statement* statement, Table* table){
+    // Tables keyed by (tenant_id, id) need a tenant and others take none
+    if (statement->with_tenant != table->keyed_by_tenant) {
+        return EXECUTE_KEY_MISMATCH;
+    }
+    ExecuteResult result = execute_insert_row(&(statement->row_to_insert), table);
+    if (result == EXECUTE_SUCCESS) {
+        statement->num_rows = 1;
+    }
+    return result;
+}
+
+ExecuteResult execute_statement (Statement* statement, Table* table) {
+    if (statement->bound_params != (1u << statement->num_params) - 1) {
+        return EXECUTE_UNBOUND_PARAMETER;
+    }
+    statement->num_rows = 0;
+    statement->rows_examined = 0;
+    statement->rows_skipped = 0;
+
+    uint64_t start = stats_clock_ns();
+    // Statements on a named table run on it rather than the table given.
+    // Creating and dropping tables name the table they create or drop.
+    bool on_named_table = statement->table_name[0] != '\0'
+        && statement->type != STATEMENT_CREATE_TABLE && statement->type != STATEMENT_DROP_TABLE;
+    if (on_named_table) {
+        table = db_table(table, statement->table_name);
+        if (table == NULL) {
+            return EXECUTE_NO_TABLE;
+        }
+    }
+
+    ExecuteResult result;
+    switch(statement->type) {
+        case(STATEMENT_INSERT):
+            result = execute_insert(statement, table);
+            break;
+        case(STATEMENT_SELECT):
+            if (statement->explain != EXPLAIN_NONE) {
+                result = execute_explain(statement, table);
+            } else if (statement->joined) {
+                result = execute_join(statement, table);
+            } else {
+                result = execute_select(statement, table);
+            }
+            break;
+        case(STATEMENT_CREATE_INDEX):
+            result = execute_create_index(statement, table);
+            break;
+        case(STATEMENT_CREATE_TABLE):
+            result = execute_create_table(statement, table);
+            break;
+        case(STATEMENT_DROP_TABLE):
+            result = execute_drop_table(statement, table);
+            break;
+        default:
+            return EXECUTE_FAILURE; 
+    }
+    stats_record_latency(TIMER_EXECUTE, start);
+    return result;
+}
+
+// End of temporary section
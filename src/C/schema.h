@@ -0,0 +1,25 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+// The columns of a row, in the order they are stored. Everything that depends
+// on the columns is generated from this list: the Row struct, its serialized
+// layout, the string columns that can be filtered on, the catalog's column
+// definitions and the functions that encode, decode, compare and print rows.
+// Each is expanded with the offset and size of every column known at compile
+// time, so none of them loops over a description of the columns at run time.
+//
+// ROW_COLUMNS is given a macro to expand each kind of column to:
+//   INTEGER(name, NAME)          a uint64_t
+//   TEXT(name, NAME, length)     at most length characters, stored null
+//                                terminated in length + 1 bytes
+// NAME is the column's name in upper case, for the constants made from it.
+
+#define ROW_COLUMNS(INTEGER, TEXT) \
+    INTEGER(id, ID) \
+    TEXT(username, USERNAME, COLUMN_USERNAME_SIZE) \
+    TEXT(email, EMAIL, COLUMN_EMAIL_SIZE)
+
+// For expansions that only want one kind of column
+#define ROW_COLUMN_IGNORE(...)
+
+#endif
@@ -0,0 +1,198 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+#define READ_CHUNK 65536
+
+// Starts the shell with its standard input and output on pipes. Its stderr
+// goes to the same pipe as stdout, as the Windows drivers had it.
+pid_t start_child(const char* db_file, int* to_child, int* from_child) {
+    int input[2];
+    int output[2];
+    if (pipe(input) == -1 || pipe(output) == -1) {
+        fprintf(stderr, "pipe failed (%d)\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        fprintf(stderr, "fork failed (%d)\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        dup2(input[0], STDIN_FILENO);
+        dup2(output[1], STDOUT_FILENO);
+        dup2(output[1], STDERR_FILENO);
+        close(input[0]);
+        close(input[1]);
+        close(output[0]);
+        close(output[1]);
+        execl(HARNESS_DB_BINARY, HARNESS_DB_BINARY, db_file, (char*)NULL);
+        fprintf(stderr, "exec %s failed (%d)\n", HARNESS_DB_BINARY, errno);
+        _exit(127);
+    }
+
+    close(input[0]);
+    close(output[1]);
+    *to_child = input[1];
+    *from_child = output[0];
+    return pid;
+}
+
+// Builds all of the input up front
+char* join_commands(const char** commands, int num_commands, size_t* length) {
+    *length = 0;
+    for (int i = 0; i < num_commands; i++) {
+        *length += strlen(commands[i]) + 1;
+    }
+    char* input = malloc(*length + 1);
+    char* end = input;
+    for (int i = 0; i < num_commands; i++) {
+        size_t command_length = strlen(commands[i]);
+        memcpy(end, commands[i], command_length);
+        end[command_length] = '\n';
+        end += command_length + 1;
+    }
+    return input;
+}
+
+// Input and output are pumped together, so neither side blocks on a full pipe
+// however much is sent or printed
+char* run_repl(const char* db_file, const char** commands, int num_commands) {
+    // A shell that exits early closes its input, which must fail the write
+    // rather than kill the test
+    signal(SIGPIPE, SIG_IGN);
+    int to_child;
+    int from_child;
+    pid_t pid = start_child(db_file, &to_child, &from_child);
+    fcntl(to_child, F_SETFL, O_NONBLOCK);
+
+    size_t input_length;
+    char* input = join_commands(commands, num_commands, &input_length);
+    size_t written = 0;
+
+    size_t output_capacity = READ_CHUNK;
+    size_t output_length = 0;
+    char* output = malloc(output_capacity + 1);
+
+    bool input_open = true;
+    if (input_length == 0) {
+        close(to_child);
+        input_open = false;
+    }
+    while (true) {
+        struct pollfd fds[2] = {{from_child, POLLIN, 0}, {to_child, POLLOUT, 0}};
+        if (poll(fds, input_open ? 2 : 1, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "poll failed (%d)\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        if (input_open && fds[1].revents != 0) {
+            ssize_t sent = write(to_child, input + written, input_length - written);
+            if (sent > 0) {
+                written += sent;
+            }
+            // The shell may exit before taking all of its input
+            if (written == input_length || (sent == -1 && errno != EAGAIN)) {
+                close(to_child);
+                input_open = false;
+            }
+        }
+
+        if (fds[0].revents != 0) {
+            if (output_capacity - output_length < READ_CHUNK) {
+                output_capacity *= 2;
+                output = realloc(output, output_capacity + 1);
+            }
+            ssize_t bytes_read = read(from_child, output + output_length, READ_CHUNK);
+            if (bytes_read <= 0) {
+                break;
+            }
+            output_length += bytes_read;
+        }
+    }
+    output[output_length] = '\0';
+
+    if (input_open) {
+        close(to_child);
+    }
+    close(from_child);
+    waitpid(pid, NULL, 0);
+    free(input);
+    return output;
+}
+
+int split_lines(char* output, char*** lines) {
+    int capacity = 64;
+    int count = 0;
+    *lines = malloc(sizeof(char*)*capacity);
+
+    char* line = output;
+    while (*line != '\0') {
+        char* end = line + strcspn(line, "\n");
+        bool last = (*end == '\0');
+        *end = '\0';
+        if (end > line && end[-1] == '\r') {
+            end[-1] = '\0';
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            *lines = realloc(*lines, sizeof(char*)*capacity);
+        }
+        (*lines)[count++] = line;
+        if (last) {
+            break;
+        }
+        line = end + 1;
+    }
+    return count;
+}
+
+bool compare_output(char** actual, int actual_count, const char** expected, int expected_count) {
+    int count = actual_count < expected_count ? actual_count : expected_count;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(actual[i], expected[i]) != 0) {
+            fprintf(stderr, "Mismatch at line %d:\nExpected: '%s'\nActual: '%s'\n", i, expected[i], actual[i]);
+            return false;
+        }
+    }
+    if (actual_count != expected_count) {
+        fprintf(stderr, "Line count mismatch: %d vs %d\n", actual_count, expected_count);
+        return false;
+    }
+    return true;
+}
+
+bool expect_output(const char* db_file, const char** commands, int num_commands,
+                   const char** expected, int num_expected) {
+    char* output = run_repl(db_file, commands, num_commands);
+    char** lines;
+    int num_lines = split_lines(output, &lines);
+    bool success = compare_output(lines, num_lines, expected, num_expected);
+    free(lines);
+    free(output);
+    return success;
+}
+
+void remove_db_file(const char* db_file) {
+    if (unlink(db_file) == -1 && errno != ENOENT) {
+        fprintf(stderr, "Unable to remove %s (%d)\n", db_file, errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+bool report(const char* name, bool passed) {
+    printf("%s: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
@@ -0,0 +1,36 @@
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <stdbool.h>
+
+// Drives the db shell from the tests. The shell runs as a child process with
+// its standard input and output on pipes; everything it prints, errors
+// included, is returned as one string.
+
+// Where the shell and the scratch database live, relative to the repository
+#define HARNESS_DB_BINARY "build/db"
+#define HARNESS_DB_FILE "build/test.db"
+
+// Runs the shell on the database file, sending each command followed by a new
+// line, and returns what it printed once it exits. The caller frees it.
+char* run_repl(const char* db_file, const char** commands, int num_commands);
+
+// Splits output into lines in place (handles \r\n and \n). The caller frees
+// the array but not the lines.
+int split_lines(char* output, char*** lines);
+
+// Compares the lines of the output with those expected, reporting the first
+// difference on stderr
+bool compare_output(char** actual, int actual_count, const char** expected, int expected_count);
+
+// Runs the commands and compares all of the output with that expected
+bool expect_output(const char* db_file, const char** commands, int num_commands,
+                   const char** expected, int num_expected);
+
+// Removes the scratch database so a test starts from an empty file
+void remove_db_file(const char* db_file);
+
+// Prints the result of a test case and returns whether it passed
+bool report(const char* name, bool passed);
+
+#endif
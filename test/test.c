@@ -1,317 +1,804 @@
-//#include "../src/C/db.c"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <windows.h>
 
-#define BUFSIZE 262144
+#include "harness.h"
 
-HANDLE hChildStdinWr = NULL; // Parent process writes commands in this variable
-HANDLE hChildStdoutRd = NULL; // Parent process reads outputs from this variable
-PROCESS_INFORMATION pi;
-DWORD desiredBufferSize = 65536;
+#define REPEAT_INSERTS 1500
+#define ORDER_BY_SPILL_ROWS 40
+#define LIMIT_OFFSET_ROWS 40
+#define JOIN_PARTITION_ROWS 30
+#define DROP_CYCLES 24 // more tables than the file could hold at once
+#define DROP_CYCLE_ROWS 30
 
-// This function creates the child process and configures the pipes
+// Test case (insert and retrieve a row)
+bool TestInsertAndSelect() {
+    const char* commands[] = {
+        "insert 1 user1 person1@example.com",
+        "select",
+        ".exit"
+    };
 
-BOOL CreateChildProcess(const char* program) {
-    SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
-    HANDLE hChildStdoutWr, hChildStdinRd;
+    const char* expected[] = {
+        "db > Executed. ",
+        "db > (1, user1, person1@example.com) ",
+        "Executed. ",
+        "db > "
+    };
 
-    // Create a pipe for child's STDOUT (parent reads)
-    if (!CreatePipe(&hChildStdoutRd, &hChildStdoutWr, &sa, desiredBufferSize)) {
-        fprintf(stderr, "CreatePipe (stdout) failed (%lu)\n", GetLastError());
-        return FALSE;
-    }
-    
-    // Ensure parent's read handle is not inherited by child
-    SetHandleInformation(hChildStdoutRd, HANDLE_FLAG_INHERIT, 0);
-
-    // Create pipe for child's STDIN (parent writes)
-    if (!CreatePipe(&hChildStdinRd, &hChildStdinWr, &sa, desiredBufferSize)) {
-        fprintf(stderr, "Create pipe (stdin) failed (%lu)\n", GetLastError());
-        return FALSE;
-    }
+    remove_db_file(HARNESS_DB_FILE);
+    return expect_output(HARNESS_DB_FILE, commands, sizeof(commands)/sizeof(commands[0]),
+                         expected, sizeof(expected)/sizeof(expected[0]));
+}
 
-    // Ensure parent's write handle is not inherited by child
-    SetHandleInformation(hChildStdinWr, HANDLE_FLAG_INHERIT, 0);
-
-    // Configure child's handles
-    STARTUPINFO si = { sizeof(STARTUPINFO) };
-    si.dwFlags = STARTF_USESTDHANDLES;
-    si.hStdInput = hChildStdinRd;
-    si.hStdOutput = hChildStdoutWr;
-    si.hStdError = hChildStdoutWr;
-
-    // Spawn child processes
-    BOOL success = CreateProcess(
-        NULL, (LPSTR)program, NULL, NULL, TRUE,
-        CREATE_NO_WINDOW, NULL, NULL, &si, &pi
-    );
-
-    if (!success) {
-        fprintf(stderr, "CreateProcess failed (%lu)\n", GetLastError());
-        return FALSE;
-    }
+// Test case (strings of the maximum length are kept whole)
+bool TestMaxLengthStrings() {
+    char long_user[32];
+    char long_email[320];
+    memset(long_user, 'a', 12);
+    long_user[12] = '\0';
+    memset(long_email, 'a', 255);
+    long_email[255] = '\0';
 
-    // Close unused handles (child's end)
-    CloseHandle(hChildStdoutWr);
-    CloseHandle(hChildStdinRd);
-    return TRUE;
+    char insert[400];
+    char row[400];
+    sprintf(insert, "insert 593829 %s %s", long_user, long_email);
+    sprintf(row, "db > (593829, %s, %s) ", long_user, long_email);
 
-}
+    const char* commands[] = {insert, "select", ".exit"};
+    const char* expected[] = {"db > Executed. ", row, "Executed. ", "db > "};
 
-// Writes a command to the child's stdin followed by a new line
-BOOL SendCommand(const char* command) {
-    DWORD bytesWritten;
-    BOOL success = WriteFile(hChildStdinWr, command, strlen(command), &bytesWritten, NULL);
-    success &= WriteFile(hChildStdinWr, "\n", 1, &bytesWritten, NULL);
-    return success;
+    remove_db_file(HARNESS_DB_FILE);
+    return expect_output(HARNESS_DB_FILE, commands, sizeof(commands)/sizeof(commands[0]),
+                         expected, sizeof(expected)/sizeof(expected[0]));
 }
 
-// Reads all outputs from child until EOF
-char* ReadAllOutput() {
-    char buffer[BUFSIZE];
-    DWORD bytesRead;
-    char* output = malloc(1);
-    output[0] = '\0';
-
-    while (ReadFile(hChildStdoutRd, buffer, BUFSIZE-1,  &bytesRead, NULL)&& bytesRead>0) {
-        buffer[bytesRead] = '\0';
-        output = realloc(output, strlen(output)+bytesRead+1);
-        strcat(output, buffer);
-    }
-    return output;
+// Test case (an id can only be inserted once)
+bool TestDuplicateKey() {
+    const char* commands[] = {
+        "insert 1 user1 person1@example.com",
+        "insert 1 user1 person1@example.com",
+        "select",
+        ".exit"
+    };
+
+    const char* expected[] = {
+        "db > Executed. ",
+        "db > Error: Duplicate key. ",
+        "db > (1, user1, person1@example.com) ",
+        "Executed. ",
+        "db > "
+    };
 
+    remove_db_file(HARNESS_DB_FILE);
+    return expect_output(HARNESS_DB_FILE, commands, sizeof(commands)/sizeof(commands[0]),
+                         expected, sizeof(expected)/sizeof(expected[0]));
 }
 
-char* ReadLastOutput() {
-    //First read all output
-    char* allOutput = ReadAllOutput();
+// Test case (bad input is rejected with a message)
+bool TestErrors() {
+    char long_user[32];
+    memset(long_user, 'a', 13);
+    long_user[13] = '\0';
+    char insert[64];
+    sprintf(insert, "insert 1 %s a@example.com", long_user);
 
-    if (allOutput[0] == '\0') {
-        // Empty output
-        return allOutput;
-    }
+    const char* commands[] = {
+        insert,
+        "insert -1 user1 person1@example.com",
+        "update 1",
+        ".open",
+        "select",
+        ".exit"
+    };
 
-    //Find the last line
-    char* lastline =allOutput;
-    char* ptr = allOutput;
+    const char* expected[] = {
+        "db > String is too long.",
+        "db > ID must be positive.",
+        "db > Unrecognised keyword at start of 'update 1'.",
+        "db > Unrecognised command '.open' ",
+        "db > Executed. ",
+        "db > "
+    };
 
-    while (*ptr) {
-        if (*ptr == '\n') {
-            lastline = ptr + 1;
-        }
-        ptr++;
-    }
+    remove_db_file(HARNESS_DB_FILE);
+    return expect_output(HARNESS_DB_FILE, commands, sizeof(commands)/sizeof(commands[0]),
+                         expected, sizeof(expected)/sizeof(expected[0]));
+}
 
-    //Create a copy of just the last line
-    char* result = _strdup(lastline);
+// Test case (tables are created, used by name and dropped)
+bool TestTables() {
+    const char* commands[] = {
+        "create table orders",
+        "insert into orders 1 user1 person1@example.com",
+        "insert 2 user2 person2@example.com",
+        "create index on orders email",
+        "select from orders where email = person1@example.com",
+        "select count(*) from users",
+        ".tables",
+        "create table orders",
+        "drop table orders",
+        "select from orders",
+        "drop table users",
+        "drop table orders",
+        ".tables",
+        ".exit"
+    };
 
-    //Free the full output buffer
-    free(allOutput);
+    const char* expected[] = {
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > (1, user1, person1@example.com) ",
+        "Executed. ",
+        "db > (1) ",
+        "Executed. ",
+        "db > Tables:",
+        "users (id integer, username text(12), email text(255))",
+        "orders (id integer, username text(12), email text(255))",
+        "db > Error: Table already exists. ",
+        "db > Executed. ",
+        "db > Error: No such table. ",
+        "db > Error: The default table cannot be dropped. ",
+        "db > Error: No such table. ",
+        "db > Tables:",
+        "users (id integer, username text(12), email text(255))",
+        "db > "
+    };
 
-    return result;
+    remove_db_file(HARNESS_DB_FILE);
+    return expect_output(HARNESS_DB_FILE, commands, sizeof(commands)/sizeof(commands[0]),
+                         expected, sizeof(expected)/sizeof(expected[0]));
 }
 
-// Splits output into lines (handles \r\n and \n)
-int SplitOutputLines(char* output, char*** lines) {
-    int count = 0;
-    char* line = strtok(output, "\r\n");
-    *lines = malloc(sizeof(char*)*BUFSIZE); // Max expected lines
-    
-    while (line != NULL) {
-        (*lines)[count++] = _strdup(line);
-        line = strtok(NULL, "\r\n");
-    }
-
-    return count;
-}
+// Test case (tables keyed by (tenant_id, id) keep each tenant's rows together,
+// and ids use all 64 bits)
+bool TestTenantKeys() {
+    const char* commands[] = {
+        "create table orders key (tenant_id, id)",
+        "insert into orders 7 2 user2 person2@example.com",
+        "insert into orders 3 9 user9 person9@example.com",
+        "insert into orders 7 1 user1 person1@example.com",
+        "insert into orders 7 1 user1 person1@example.com",
+        "insert into orders 5 user5 person5@example.com",
+        "insert 3 1 user1 person1@example.com",
+        "select from orders where tenant_id = 7",
+        "select count(*) from orders",
+        "insert 18446744073709551615 user1 person1@example.com",
+        "insert 18446744073709551616 user1 person1@example.com",
+        "select",
+        ".tables",
+        ".exit"
+    };
 
-// Compares actual output lines with expected output lines
-BOOL CompareOutput(char** actual, int actualCount, char** expected, int expectedCount) {
-    if (actualCount != expectedCount) {
-        fprintf(stderr, "Line count mismatch: %d vs %d\n", actualCount, expectedCount);
-        return FALSE;
-    }
+    const char* expected[] = {
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Error: Duplicate key. ",
+        "db > Error: Key does not match the table. ",
+        "db > Error: Key does not match the table. ",
+        "db > (7, 1, user1, person1@example.com) ",
+        "(7, 2, user2, person2@example.com) ",
+        "Executed. ",
+        "db > (3) ",
+        "Executed. ",
+        "db > Executed. ",
+        "db > ID is too large.",
+        "db > (18446744073709551615, user1, person1@example.com) ",
+        "Executed. ",
+        "db > Tables:",
+        "users (id integer, username text(12), email text(255))",
+        "orders (id integer, username text(12), email text(255)) key (tenant_id, id)",
+        "db > "
+    };
 
-    for (int i=0; i < actualCount; i++) {
-        if (strcmp(actual[i], expected[i])!= 0) {
-            fprintf(stderr, "Mismatch at line %d:\nExpected: '%s'\nActual: '%s'\n",i, expected[i], actual[i]);
-            return FALSE;
-        }
-    }
-    return TRUE;
+    remove_db_file(HARNESS_DB_FILE);
+    return expect_output(HARNESS_DB_FILE, commands, sizeof(commands)/sizeof(commands[0]),
+                         expected, sizeof(expected)/sizeof(expected[0]));
 }
 
-void generate_expected(char* new_array[]) {
-    new_array[0] = "db > 'insert 1 user1 person1@example.com'. ";
-    new_array[1] = "Executed. ";
-    new_array[2] = "db > 'select'. ";
-    new_array[3] = "(1, user1, person1@example.com) ";
-    new_array[4] ="Executed. "; 
-
-    char tempInsert[64];
+// Test case (unindexed where clauses match whole values and prefixes, across
+// the eight byte words scans compare them in)
+bool TestScanFilters() {
+    const char* commands[] = {
+        "insert 1 user1 person1@example.com",
+        "insert 2 user2 person12@example.com",
+        "insert 3 user12345678 person1@example.co",
+        "select count(*) where email = person1@example.com",
+        "select count(*) where email like 'person1%'",
+        "select count(*) where email like 'person1@example.co%'",
+        "select where username = user12345678",
+        "select count(*) where username = user1234567",
+        "select count(*) where username like '%'",
+        ".exit"
+    };
 
-    for (int k=0; k<1500; k++) {
-        sprintf(tempInsert, "db > 'insert %d user%d person%d@example.com'. ", k, k, k);
-        new_array[2*k+5] = tempInsert;
-        new_array[2*k+6] = "Executed. ";
-    }
-    new_array[3008] = NULL;
+    const char* expected[] = {
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > (1) ",
+        "Executed. ",
+        "db > (3) ",
+        "Executed. ",
+        "db > (2) ",
+        "Executed. ",
+        "db > (3, user12345678, person1@example.co) ",
+        "Executed. ",
+        "db > (0) ",
+        "Executed. ",
+        "db > (3) ",
+        "Executed. ",
+        "db > "
+    };
 
+    remove_db_file(HARNESS_DB_FILE);
+    return expect_output(HARNESS_DB_FILE, commands, sizeof(commands)/sizeof(commands[0]),
+                         expected, sizeof(expected)/sizeof(expected[0]));
 }
 
-// Test case (insert and retrieve a row)
-BOOL TestInsertAndSelect() {
+// Test case (rows come out in the order asked for, ties in id order, up to the
+// limit)
+bool TestOrderBy() {
     const char* commands[] = {
-        "insert 1 user1 person1@example.com", "select"
-        //,".exit"
+        "insert 3 carol person1@example.com",
+        "insert 1 bob person3@example.com",
+        "insert 2 alice person4@example.com",
+        "insert 4 bob person2@example.com",
+        "select order by username",
+        "select order by email limit 2",
+        "select where username = bob order by email",
+        "select order by id",
+        ".exit"
     };
 
-    char* expected[3009];
-    generate_expected(expected);
-
-    // for (int i = 0; i < 3008; i++)  {
-    //     printf(expected[i]);
-    // }
-    // // const char* expected[] = {
-    //     "db > 'insert 1 user1 person1@example.com'. ",
-    //     "Executed. ",
-    //     "db > 'select'. ",
-    //     "(1, user1, person1@example.com) ",
-    //     "Executed. ", 
-    //     "db > '.exit'. "
-    // };
-
-    // Send commands to child
-    for (int i=0; i < sizeof(commands)/sizeof(commands[0]); i++) {
-        if (!SendCommand(commands[i])) {
-            fprintf(stderr, "Failed to send command: %s\n", commands[i]);
-            return FALSE;
-        }
-    }
+    const char* expected[] = {
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > (2, alice, person4@example.com) ",
+        "(1, bob, person3@example.com) ",
+        "(4, bob, person2@example.com) ",
+        "(3, carol, person1@example.com) ",
+        "Executed. ",
+        "db > (3, carol, person1@example.com) ",
+        "(4, bob, person2@example.com) ",
+        "Executed. ",
+        "db > (4, bob, person2@example.com) ",
+        "(1, bob, person3@example.com) ",
+        "Executed. ",
+        "db > Syntax error. Could not parse statement.",
+        "db > "
+    };
 
-    
-    char long_user[32]; 
-    char long_email[320];
+    remove_db_file(HARNESS_DB_FILE);
+    return expect_output(HARNESS_DB_FILE, commands, sizeof(commands)/sizeof(commands[0]),
+                         expected, sizeof(expected)/sizeof(expected[0]));
+}
 
-    for (int i=0; i<12; i++) {
-        long_user[i]='a';
+// Test case (a sort too big for its memory spills to runs that are merged,
+// over more than one pass when there are many). No file is big enough to spill
+// at the default memory, so it is cut to one byte, and one row fits in memory.
+bool TestOrderBySpill() {
+    const char* commands[ORDER_BY_SPILL_ROWS + 3];
+    char inserts[ORDER_BY_SPILL_ROWS][64];
+    for (int i = 0; i < ORDER_BY_SPILL_ROWS; i++) {
+        // Usernames descend as ids ascend
+        sprintf(inserts[i], "insert %d user%02d person%d@example.com", i + 1, ORDER_BY_SPILL_ROWS - i, i + 1);
+        commands[i] = inserts[i];
     }
-    long_user[12] = '\0';
+    commands[ORDER_BY_SPILL_ROWS] = "select order by username";
+    commands[ORDER_BY_SPILL_ROWS + 1] = "select order by username limit 3";
+    commands[ORDER_BY_SPILL_ROWS + 2] = ".exit";
+
+    const char* expected[2*ORDER_BY_SPILL_ROWS + 6];
+    char rows[ORDER_BY_SPILL_ROWS][64];
+    int num_expected = 0;
+    for (int i = 0; i < ORDER_BY_SPILL_ROWS; i++) {
+        expected[num_expected++] = "db > Executed. ";
+    }
+    for (int i = 0; i < ORDER_BY_SPILL_ROWS; i++) {
+        int id = ORDER_BY_SPILL_ROWS - i;
+        sprintf(rows[i], "%s(%d, user%02d, person%d@example.com) ", i == 0 ? "db > " : "", id, i + 1, id);
+        expected[num_expected++] = rows[i];
+    }
+    expected[num_expected++] = "Executed. ";
+    for (int i = 0; i < 3; i++) {
+        expected[num_expected++] = rows[i];
+    }
+    expected[num_expected++] = "Executed. ";
+    expected[num_expected++] = "db > ";
+
+    setenv("DB_SORT_MEMORY", "1", 1);
+    remove_db_file(HARNESS_DB_FILE);
+    bool success = expect_output(HARNESS_DB_FILE, commands, sizeof(commands)/sizeof(commands[0]),
+                                 expected, num_expected);
+    unsetenv("DB_SORT_MEMORY");
+    return success;
+}
 
-    for (int i=0; i<255; i++) {
-        long_email[i]='a';
+// Test case (an offset skips rows from the start of a select, by seeking to
+// the row at it when every row is wanted in id order). The rows span several
+// leaves.
+bool TestLimitOffset() {
+    const char* commands[LIMIT_OFFSET_ROWS + 10];
+    char inserts[LIMIT_OFFSET_ROWS][64];
+    for (int i = 0; i < LIMIT_OFFSET_ROWS; i++) {
+        // Usernames descend as ids ascend
+        sprintf(inserts[i], "insert %d user%02d person%d@example.com", i + 1, LIMIT_OFFSET_ROWS - i, i + 1);
+        commands[i] = inserts[i];
     }
-    long_email[255] = '\0';
+    int num_commands = LIMIT_OFFSET_ROWS;
+    commands[num_commands++] = "select limit 2 offset 30";
+    commands[num_commands++] = "select offset 38";
+    commands[num_commands++] = "select offset 40";
+    commands[num_commands++] = "select order by username limit 2 offset 1";
+    commands[num_commands++] = "select where username like 'user1%' offset 8";
+    commands[num_commands++] = "select count(*) offset 5";
+    commands[num_commands++] = "explain select limit 2 offset 30";
+    commands[num_commands++] = "explain select where username = bob offset 3";
+    commands[num_commands++] = "select offset";
+    commands[num_commands++] = ".exit";
+
+    const char* expected[LIMIT_OFFSET_ROWS + 30];
+    char rows[LIMIT_OFFSET_ROWS + 1][64];
+    for (int id = 1; id <= LIMIT_OFFSET_ROWS; id++) {
+        sprintf(rows[id], "(%d, user%02d, person%d@example.com) ", id, LIMIT_OFFSET_ROWS + 1 - id, id);
+    }
+    int num_expected = 0;
+    for (int i = 0; i < LIMIT_OFFSET_ROWS; i++) {
+        expected[num_expected++] = "db > Executed. ";
+    }
+    expected[num_expected++] = "db > (31, user10, person31@example.com) ";
+    expected[num_expected++] = rows[32];
+    expected[num_expected++] = "Executed. ";
+    expected[num_expected++] = "db > (39, user02, person39@example.com) ";
+    expected[num_expected++] = rows[40];
+    expected[num_expected++] = "Executed. ";
+    expected[num_expected++] = "db > Executed. ";
+    expected[num_expected++] = "db > (39, user02, person39@example.com) ";
+    expected[num_expected++] = rows[38];
+    expected[num_expected++] = "Executed. ";
+    expected[num_expected++] = "db > (30, user11, person30@example.com) ";
+    expected[num_expected++] = rows[31];
+    expected[num_expected++] = "Executed. ";
+    expected[num_expected++] = "db > (40) ";
+    expected[num_expected++] = "Executed. ";
+    expected[num_expected++] = "db > limit 2, offset 30";
+    expected[num_expected++] = "  offset seek users to row 30";
+    expected[num_expected++] = "Executed. ";
+    expected[num_expected++] = "db > offset 3";
+    expected[num_expected++] = "  scan users where username = 'bob'";
+    expected[num_expected++] = "Executed. ";
+    expected[num_expected++] = "db > Syntax error. Could not parse statement.";
+    expected[num_expected++] = "db > ";
+
+    remove_db_file(HARNESS_DB_FILE);
+    return expect_output(HARNESS_DB_FILE, commands, num_commands, expected, num_expected);
+}
 
-    char command2[400];
-    sprintf(command2, "insert 593829 %s %s", long_user, long_email);
-    // printf("long user: %s", long_user);
-    // printf("long email: %s", long_email);
+// Test case (joins merge tables keyed alike on their key, keeping tenants to
+// their own rows, and hash the rest, with the left table's columns first)
+bool TestJoin() {
+    const char* commands[] = {
+        "create table b",
+        "create table t key (tenant_id, id)",
+        "insert 1 alice person1@example.com",
+        "insert 2 bob person2@example.com",
+        "insert 3 carol person3@example.com",
+        "insert into b 2 bobby person2@example.com",
+        "insert into b 3 carol person9@example.com",
+        "insert into b 4 dan person4@example.com",
+        "insert into b 5 bob2 person2@example.com",
+        "insert into t 7 3 tc person3@example.com",
+        "select from users join b on id",
+        "select from users join b on email",
+        "select from users join b on username",
+        "select count(*) from b join users on email",
+        "select from users join b on email limit 1",
+        "select from t join users on id",
+        "select from users join b on email where username = bob",
+        "select from users join c on id",
+        "create table t2 key (tenant_id, id)",
+        "insert into t 8 3 td person3@example.com",
+        "insert into t2 7 3 tc2 person3@example.com",
+        "insert into t2 8 4 td2 person4@example.com",
+        "select from t join t2 on id",
+        "select count(*) from t join users on id",
+        ".exit"
+    };
 
-    if (!SendCommand(command2)){
-        fprintf(stderr, "Failed to send command: %s\n", command2);
-    }
+    const char* expected[] = {
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > (2, bob, person2@example.com, 2, bobby, person2@example.com) ",
+        "(3, carol, person3@example.com, 3, carol, person9@example.com) ",
+        "Executed. ",
+        "db > (2, bob, person2@example.com, 2, bobby, person2@example.com) ",
+        "(2, bob, person2@example.com, 5, bob2, person2@example.com) ",
+        "Executed. ",
+        "db > (3, carol, person3@example.com, 3, carol, person9@example.com) ",
+        "Executed. ",
+        "db > (2) ",
+        "Executed. ",
+        "db > (2, bob, person2@example.com, 2, bobby, person2@example.com) ",
+        "Executed. ",
+        "db > (7, 3, tc, person3@example.com, 3, carol, person3@example.com) ",
+        "Executed. ",
+        "db > Syntax error. Could not parse statement.",
+        "db > Error: No such table. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > (7, 3, tc, person3@example.com, 7, 3, tc2, person3@example.com) ",
+        "Executed. ",
+        "db > (2) ",
+        "Executed. ",
+        "db > "
+    };
 
-    char repeatCommand[64];
-        
-    for (int j=0; j<1500; j++) {
-        sprintf(repeatCommand, "insert %d user%d person%d@example.com", j, j, j);
-        if(!SendCommand(repeatCommand)) {
-            fprintf(stderr, "Failed to send Command: %s\n", repeatCommand);
+    remove_db_file(HARNESS_DB_FILE);
+    return expect_output(HARNESS_DB_FILE, commands, sizeof(commands)/sizeof(commands[0]),
+                         expected, sizeof(expected)/sizeof(expected[0]));
+}
+
+// Test case (a join whose hashed side is too big for its memory partitions
+// both sides to temporary files). Every other row of b matches one in users.
+bool TestJoinPartitioned() {
+    const char* commands[2*JOIN_PARTITION_ROWS + 4];
+    char inserts[2*JOIN_PARTITION_ROWS][64];
+    int num_commands = 0;
+    commands[num_commands++] = "create table b";
+    for (int i = 0; i < JOIN_PARTITION_ROWS; i++) {
+        sprintf(inserts[2*i], "insert %d user%d person%d@example.com", i + 1, i + 1, i + 1);
+        sprintf(inserts[2*i + 1], "insert into b %d b%d person%d@example.com", i + 1, i + 1, 2*(i + 1));
+        commands[num_commands++] = inserts[2*i];
+        commands[num_commands++] = inserts[2*i + 1];
+    }
+    commands[num_commands++] = "select count(*) from users join b on email";
+    commands[num_commands++] = "select from b join users on email limit 1";
+    commands[num_commands++] = ".exit";
+
+    const char* expected[2*JOIN_PARTITION_ROWS + 6];
+    int num_expected = 0;
+    for (int i = 0; i < 2*JOIN_PARTITION_ROWS + 1; i++) {
+        expected[num_expected++] = "db > Executed. ";
+    }
+    char count[32];
+    sprintf(count, "db > (%d) ", JOIN_PARTITION_ROWS/2);
+    expected[num_expected++] = count;
+    expected[num_expected++] = "Executed. ";
+    expected[num_expected] = NULL; // the row the limit keeps depends on the partitions
+    int limited_row = num_expected++;
+    expected[num_expected++] = "Executed. ";
+    expected[num_expected++] = "db > ";
+
+    setenv("DB_JOIN_MEMORY", "1", 1);
+    remove_db_file(HARNESS_DB_FILE);
+    char* output = run_repl(HARNESS_DB_FILE, commands, num_commands);
+    unsetenv("DB_JOIN_MEMORY");
+    char** lines;
+    int num_lines = split_lines(output, &lines);
+
+    bool success = (num_lines == num_expected);
+    for (int i = 0; success && i < num_expected; i++) {
+        int id, user_id;
+        bool matches = (i == limited_row)
+            ? sscanf(lines[i], "db > (%d, b%*d, person%*d@example.com, %d, user", &id, &user_id) == 2
+                && user_id == 2*id
+            : strcmp(lines[i], expected[i]) == 0;
+        if (!matches) {
+            fprintf(stderr, "Mismatch at line %d: '%s'\n", i, lines[i]);
+            success = false;
         }
-        // printf("Sent command: %s\n", repeatCommand);
     }
+    if (num_lines != num_expected) {
+        fprintf(stderr, "Line count mismatch: %d vs %d\n", num_lines, num_expected);
+    }
+    free(lines);
+    free(output);
+    return success;
+}
 
-    //Close input pipe to signal EOF
-    CloseHandle(hChildStdinWr);
+// Test case (explain prints how a select finds its rows, from a scan, a seek to
+// a tenant's rows or an index lookup, and how a join joins)
+bool TestExplain() {
+    const char* commands[] = {
+        "create table t key (tenant_id, id)",
+        "create index on email",
+        "explain select",
+        "explain select where username = bob",
+        "explain select where email like 'person%' order by username limit 2",
+        "explain select count(*) from t where tenant_id = 7",
+        "explain select from users join t on email limit 5",
+        "explain select from users join users on id",
+        "explain select from users join zz on id",
+        "explain insert 1 user1 person1@example.com",
+        ".exit"
+    };
 
+    const char* expected[] = {
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > scan users",
+        "Executed. ",
+        "db > scan users where username = 'bob'",
+        "Executed. ",
+        "db > sort by username, keeping 2",
+        "  index lookup users where email like 'person%'",
+        "Executed. ",
+        "db > count",
+        "  key seek t where tenant_id = 7",
+        "Executed. ",
+        "db > limit 5",
+        "  hash join on email",
+        "    hash users",
+        "    scan t",
+        "Executed. ",
+        "db > merge join on id",
+        "  scan users",
+        "  scan users",
+        "Executed. ",
+        "db > Error: No such table. ",
+        "db > Syntax error. Could not parse statement.",
+        "db > "
+    };
 
-    //Read and parse output
-    char* output = ReadAllOutput();
-    char** actualLines;
-    int actualCount = SplitOutputLines(output, &actualLines);
-    // printf("Total Output:\n" );
-    // for (int i; i<actualCount; i++) {
-    //     printf("%d  %s\n", i, actualLines[i]);
-    // }
+    remove_db_file(HARNESS_DB_FILE);
+    return expect_output(HARNESS_DB_FILE, commands, sizeof(commands)/sizeof(commands[0]),
+                         expected, sizeof(expected)/sizeof(expected[0]));
+}
 
-    // Validate Output
+// Cuts the times and page counts out of explain analyze's output, which vary
+// from run to run
+void strip_measurements(char* line) {
+    if (strncmp(line, "pages: ", 7) == 0 || strncmp(line, "time: ", 6) == 0) {
+        strchr(line, ' ')[0] = '\0';
+        return;
+    }
+    char* time = strstr(line, " ms)");
+    if (time != NULL) {
+        char* start = time;
+        while (start > line && start[-1] != ',') {
+            start--;
+        }
+        memmove(start - 1, time + 3, strlen(time + 3) + 1);
+    }
+}
 
-    BOOL success = CompareOutput(
-        actualLines, actualCount,
-        expected, sizeof(expected)/sizeof(char *)
-    );
+// Test case (explain analyze runs the select without printing its rows, and
+// reports the rows each step read and returned)
+bool TestExplainAnalyze() {
+    const char* commands[] = {
+        "create table b",
+        "insert 1 user1 person1@example.com",
+        "insert 2 user2 person2@example.com",
+        "insert 3 user3 person3@example.com",
+        "insert into b 2 user2 person2@example.com",
+        "create index on username",
+        "explain analyze select where email = person2@example.com",
+        "explain analyze select where username like 'user%' order by email limit 2",
+        "explain analyze select count(*) from users join b on email",
+        ".exit"
+    };
 
+    const char* expected[] = {
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > Executed. ",
+        "db > scan users where email = 'person2@example.com' (rows 1 of 3 examined)",
+        "pages:",
+        "rows: 3 examined, 1 returned",
+        "time:",
+        "Executed. ",
+        "db > sort by email, keeping 2 (rows 2)",
+        "  index lookup users where username like 'user%' (rows 3 of 3 examined)",
+        "pages:",
+        "rows: 3 examined, 2 returned",
+        "time:",
+        "Executed. ",
+        "db > count (rows 1)",
+        "  hash join on email (rows 1)",
+        "    hash b (rows 1)",
+        "    scan users (rows 3)",
+        "pages:",
+        "rows: 4 examined, 1 returned",
+        "time:",
+        "Executed. ",
+        "db > "
+    };
 
-    // BOOL success = CompareOutput(
-    //     actualLines, actualCount,
-    //     expected, sizeof(expected)/sizeof(expected[0])
-    // );
+    remove_db_file(HARNESS_DB_FILE);
+    char* output = run_repl(HARNESS_DB_FILE, commands, sizeof(commands)/sizeof(commands[0]));
+    char** lines;
+    int num_lines = split_lines(output, &lines);
+    for (int i = 0; i < num_lines; i++) {
+        strip_measurements(lines[i]);
+    }
+    bool success = compare_output(lines, num_lines, expected, sizeof(expected)/sizeof(expected[0]));
+    free(lines);
+    free(output);
+    return success;
+}
 
-/*
-    char repeatCommand[128];
-    char expectedFinal[] = "Error: Table full. ";
-    char* repeatOutput = NULL;
-    int i = 1;
+// Test case (a select with a limit stops reading once it has its rows,
+// whether it scans, looks up an index or seeks to a tenant)
+bool TestLimitStopsEarly() {
+    const char* commands[LIMIT_OFFSET_ROWS + 12];
+    char inserts[LIMIT_OFFSET_ROWS][64];
+    for (int i = 0; i < LIMIT_OFFSET_ROWS; i++) {
+        sprintf(inserts[i], "insert %d user%02d person%d@example.com", i + 1, LIMIT_OFFSET_ROWS - i, i + 1);
+        commands[i] = inserts[i];
+    }
+    int num_commands = LIMIT_OFFSET_ROWS;
+    commands[num_commands++] = "create table t key (tenant_id, id)";
+    commands[num_commands++] = "insert into t 7 1 a a@example.com";
+    commands[num_commands++] = "insert into t 7 2 b b@example.com";
+    commands[num_commands++] = "insert into t 7 3 c c@example.com";
+    commands[num_commands++] = "create index on username";
+    commands[num_commands++] = "explain analyze select limit 3";
+    commands[num_commands++] = "explain analyze select where username like 'user1%' limit 2";
+    commands[num_commands++] = "explain analyze select from t where tenant_id = 7 limit 2";
+    commands[num_commands++] = ".exit";
+
+    const char* expected[LIMIT_OFFSET_ROWS + 30];
+    int num_expected = 0;
+    for (int i = 0; i < LIMIT_OFFSET_ROWS + 5; i++) {
+        expected[num_expected++] = "db > Executed. ";
+    }
+    // The scan reads its first leaf only
+    expected[num_expected++] = "db > limit 3 (rows 3)";
+    expected[num_expected++] = "  scan users (rows 3 of 12 examined)";
+    expected[num_expected++] = "pages:";
+    expected[num_expected++] = "rows: 12 examined, 3 returned";
+    expected[num_expected++] = "time:";
+    expected[num_expected++] = "Executed. ";
+    expected[num_expected++] = "db > limit 2 (rows 2)";
+    expected[num_expected++] = "  index lookup users where username like 'user1%' (rows 2 of 2 examined)";
+    expected[num_expected++] = "pages:";
+    expected[num_expected++] = "rows: 2 examined, 2 returned";
+    expected[num_expected++] = "time:";
+    expected[num_expected++] = "Executed. ";
+    expected[num_expected++] = "db > limit 2 (rows 2)";
+    expected[num_expected++] = "  key seek t where tenant_id = 7 (rows 2 of 2 examined)";
+    expected[num_expected++] = "pages:";
+    expected[num_expected++] = "rows: 2 examined, 2 returned";
+    expected[num_expected++] = "time:";
+    expected[num_expected++] = "Executed. ";
+    expected[num_expected++] = "db > ";
+
+    remove_db_file(HARNESS_DB_FILE);
+    char* output = run_repl(HARNESS_DB_FILE, commands, num_commands);
+    char** lines;
+    int num_lines = split_lines(output, &lines);
+    for (int i = 0; i < num_lines; i++) {
+        strip_measurements(lines[i]);
+    }
+    bool success = compare_output(lines, num_lines, expected, num_expected);
+    free(lines);
+    free(output);
+    return success;
+}
 
-    do {
-        sprintf(repeatCommand, "insert %d user%d person%d@example.com", i,i,i);
-        if(!SendCommand(repeatCommand)) {
-            printf("%s\n", repeatCommand);
-            fprintf(stderr, "Failed to send command: %s\n", repeatCommand);
-            break;
+// Test case (inserting many rows). Every insert succeeds until the table is
+// full, after which every one reports it.
+bool TestRepeatedInserts() {
+    const char** commands = malloc(sizeof(char*)*(REPEAT_INSERTS + 1));
+    for (int i = 0; i < REPEAT_INSERTS; i++) {
+        char* command = malloc(64);
+        sprintf(command, "insert %d user%d person%d@example.com", i + 1, i + 1, i + 1);
+        commands[i] = command;
+    }
+    commands[REPEAT_INSERTS] = ".exit";
+
+    remove_db_file(HARNESS_DB_FILE);
+    char* output = run_repl(HARNESS_DB_FILE, commands, REPEAT_INSERTS + 1);
+    char** lines;
+    int num_lines = split_lines(output, &lines);
+
+    bool success = (num_lines == REPEAT_INSERTS + 1);
+    bool full = false;
+    for (int i = 0; success && i < REPEAT_INSERTS; i++) {
+        if (!full && strcmp(lines[i], "db > Error: Table full. ") == 0) {
+            full = (i > 0);
+        }
+        const char* expected = full ? "db > Error: Table full. " : "db > Executed. ";
+        if (strcmp(lines[i], expected) != 0) {
+            fprintf(stderr, "Mismatch at line %d:\nExpected: '%s'\nActual: '%s'\n", i, expected, lines[i]);
+            success = false;
         }
-        i++;
-        repeatOutput = ReadLastOutput();
-    } while (strcmp(repeatOutput, expectedFinal)!=0);
+    }
+    if (num_lines != REPEAT_INSERTS + 1) {
+        fprintf(stderr, "Line count mismatch: %d vs %d\n", num_lines, REPEAT_INSERTS + 1);
+    }
 
-*/
-    //Clean up
+    free(lines);
     free(output);
-    for (int i = 0; i < actualCount; i++) {free(actualLines[i]);}
-    free(actualLines);
+    for (int i = 0; i < REPEAT_INSERTS; i++) {
+        free((char*)commands[i]);
+    }
+    free(commands);
     return success;
 }
 
-
-// void test_command_read() {
-//     FILE *fp;
-//     char buffer[128];
-//     const char *command = "dir";
-
-
-//     fp = popen(command, "r");
-//     if (fp==NULL) {
-//         perror("popen failed. \n");
-//         exit(EXIT_FAILURE);
-//     }
-
-//     while (fgets(buffer, sizeof(buffer), fp)!= NULL) {
-//         printf("Recieved %s", buffer);
-//     }
-
-//     pclose(fp);
-// }
-
-
-int main(){
-    // test_command_read();
-    // return 0;
-    if (!CreateChildProcess("db.exe")) return 1;
-
-    BOOL testResult = TestInsertAndSelect();
-    if (testResult) {
-        printf("The test is successful");
+// Test case (a dropped table's pages, and its index's, are reused by the
+// tables created after it, in the same session and the next)
+bool TestDropReusesPages() {
+    const int commands_per_cycle = DROP_CYCLE_ROWS + 4;
+    const int cycles_per_session = DROP_CYCLES/2;
+    const int num_commands = cycles_per_session*commands_per_cycle + 1;
+    const char** commands = malloc(sizeof(char*)*num_commands);
+    const char** expected = malloc(sizeof(char*)*(num_commands + cycles_per_session));
+    char inserts[DROP_CYCLE_ROWS][64];
+    char count[32];
+    for (int i = 0; i < DROP_CYCLE_ROWS; i++) {
+        sprintf(inserts[i], "insert into d %d user%d person%d@example.com", i + 1, i + 1, i + 1);
     }
-    else {
-        printf("The test has failed");
+    sprintf(count, "db > (%d) ", DROP_CYCLE_ROWS);
+
+    int c = 0;
+    int e = 0;
+    for (int cycle = 0; cycle < cycles_per_session; cycle++) {
+        commands[c++] = "create table d";
+        commands[c++] = "create index on d email";
+        for (int i = 0; i < DROP_CYCLE_ROWS; i++) {
+            commands[c++] = inserts[i];
+        }
+        commands[c++] = "select count(*) from d";
+        commands[c++] = "drop table d";
+        for (int i = 0; i < DROP_CYCLE_ROWS + 2; i++) {
+            expected[e++] = "db > Executed. ";
+        }
+        expected[e++] = count;
+        expected[e++] = "Executed. ";
+        expected[e++] = "db > Executed. ";
     }
-    //Cleanup
-    CloseHandle(hChildStdoutRd);
-    CloseHandle(pi.hProcess);
-    CloseHandle(pi.hThread);
+    commands[c++] = ".exit";
+    expected[e++] = "db > ";
+
+    remove_db_file(HARNESS_DB_FILE);
+    bool success = expect_output(HARNESS_DB_FILE, commands, c, expected, e);
+    success &= expect_output(HARNESS_DB_FILE, commands, c, expected, e);
+    free(expected);
+    free(commands);
+    return success;
+}
 
-    return testResult ? 0 : 1;
-}
\ No newline at end of file
+int main() {
+    bool success = true;
+    success &= report("insert and select", TestInsertAndSelect());
+    success &= report("maximum length strings", TestMaxLengthStrings());
+    success &= report("errors", TestErrors());
+    success &= report("duplicate key", TestDuplicateKey());
+    success &= report("tables", TestTables());
+    success &= report("drop reuses pages", TestDropReusesPages());
+    success &= report("tenant keys", TestTenantKeys());
+    success &= report("scan filters", TestScanFilters());
+    success &= report("order by", TestOrderBy());
+    success &= report("order by spill", TestOrderBySpill());
+    success &= report("limit and offset", TestLimitOffset());
+    success &= report("join", TestJoin());
+    success &= report("join partitioned", TestJoinPartitioned());
+    success &= report("explain", TestExplain());
+    success &= report("explain analyze", TestExplainAnalyze());
+    success &= report("limit stops early", TestLimitStopsEarly());
+    success &= report("repeated inserts", TestRepeatedInserts());
+    remove_db_file(HARNESS_DB_FILE);
+    return success ? 0 : 1;
+}
@@ -0,0 +1,541 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "harness.h"
+
+// Randomized stress test, linked against the engine directly. Inserts, point
+// lookups, index lookups, full scans and reopens are interleaved at random and
+// every result is checked against a reference model of the rows that should be
+// in the table. Some inserts go through a cached prepared statement and some
+// are grouped into transactions. A table that fills up is replaced by an empty
+// one, so long runs keep exercising inserts. Every other file is compressed,
+// and every third bypasses the OS page cache. Half of the files scan on
+// several threads, however many cores there are.
+//
+// Pages of a compressed file move to a new slot each time they are written,
+// so a compressed file holds old copies of its pages too, but it should stay
+// smaller than its pages would be uncompressed.
+//
+// Afterwards, reader threads check that every snapshot they take is
+// consistent while the writer fills more files.
+//
+// Usage: test_stress [<operations> [<seed>]]
+
+#define STRESS_DEFAULT_OPERATIONS 200000
+#define STRESS_ID_SPACE (1 << 20)
+#define STRESS_SCAN_THREADS 4
+#define STRESS_READERS 3
+#define STRESS_CONCURRENT_FILES 8
+
+// The rows the table should hold. Row contents follow from the id, so the
+// ids are all the model keeps.
+typedef struct {
+    uint8_t* present; // by id
+    uint32_t* ids; // those present, in no order
+    uint32_t num_ids;
+    uint32_t max_id;
+    bool indexed[NUM_STRING_COLUMNS];
+} Model;
+
+uint64_t random_state;
+uint64_t operation;
+OpenFlags open_flags; // the current file's
+uint32_t scan_threads; // the current file's
+StatementCache* statement_cache;
+
+uint64_t next_random_from(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dull;
+}
+
+uint64_t next_random() {
+    return next_random_from(&random_state);
+}
+
+void fail(const char* message, uint32_t id) {
+    fprintf(stderr, "Operation %llu: %s (id %u)\n", (unsigned long long)operation, message, id);
+    exit(EXIT_FAILURE);
+}
+
+void make_row(uint32_t id, Row* row) {
+    row->tenant_id = 0;
+    row->id = id;
+    snprintf(row->username, sizeof(row->username), "u%u", id);
+    snprintf(row->email, sizeof(row->email), "person%u@example.com", id);
+}
+
+void check_row(Row* row, uint32_t id) {
+    Row expected;
+    make_row(id, &expected);
+    if (row->id != id || strcmp(row->username, expected.username) != 0 ||
+        strcmp(row->email, expected.email) != 0) {
+        fail("row has the wrong contents", id);
+    }
+}
+
+void model_reset(Model* model) {
+    memset(model->present, 0, STRESS_ID_SPACE);
+    model->num_ids = 0;
+    model->max_id = 0;
+    for (StringColumn column = 0; column < NUM_STRING_COLUMNS; column++) {
+        model->indexed[column] = false;
+    }
+}
+
+void check_file_size() {
+    struct stat file;
+    if (stat(HARNESS_DB_FILE, &file) != 0) {
+        fail("file is missing", 0);
+    }
+    if ((open_flags & DB_OPEN_COMPRESSED) && file.st_size > (off_t)TABLE_MAX_PAGES*PAGE_SIZE) {
+        fail("compressed file grew past its pages uncompressed", 0);
+    }
+}
+
+Table* open_file() {
+    Table* table = db_open_with(HARNESS_DB_FILE, open_flags);
+    db_set_scan_threads(table, scan_threads);
+    return table;
+}
+
+Table* open_empty(Model* model, uint64_t num_tables) {
+    remove_db_file(HARNESS_DB_FILE);
+    model_reset(model);
+    open_flags = (num_tables % 2 == 0 ? DB_OPEN_DEFAULT : DB_OPEN_COMPRESSED) |
+                 (num_tables % 3 == 0 ? DB_OPEN_DIRECT : DB_OPEN_DEFAULT);
+    scan_threads = num_tables % 4 < 2 ? STRESS_SCAN_THREADS : 1;
+    return open_file();
+}
+
+// Runs a statement, returning the rows it matched
+uint32_t run_statement(Table* table, const char* sql, ExecuteResult expected) {
+    Statement statement;
+    if (statement_prepare(sql, &statement) != PREPARE_SUCCESS) {
+        fail("statement did not prepare", 0);
+    }
+    if (execute_statement(&statement, table) != expected) {
+        fail("statement gave the wrong result", 0);
+    }
+    return statement.num_rows;
+}
+
+// Inserts the row through a cached "insert ? ? ?", first checking that it
+// will not run with parameters unbound or bound to values that do not fit
+ExecuteResult insert_prepared(Table* table, Row* row) {
+    Statement statement;
+    if (statement_cache_prepare(statement_cache, "insert ? ? ?", &statement) != PREPARE_SUCCESS) {
+        fail("insert did not prepare", row->id);
+    }
+    if (execute_statement(&statement, table) != EXECUTE_UNBOUND_PARAMETER) {
+        fail("insert ran with its parameters unbound", row->id);
+    }
+    char too_long[COLUMN_EMAIL_SIZE + 2];
+    memset(too_long, 'x', COLUMN_EMAIL_SIZE + 1);
+    too_long[COLUMN_EMAIL_SIZE + 1] = '\0';
+    if (statement_bind_text(&statement, 2, too_long) != PREPARE_STRING_TOO_LONG ||
+        statement_bind_id(&statement, 1, row->id) != PREPARE_BAD_PARAMETER ||
+        statement_bind_id(&statement, 3, row->id) != PREPARE_BAD_PARAMETER) {
+        fail("bad parameter was bound", row->id);
+    }
+    if (statement_bind_id(&statement, 0, row->id) != PREPARE_SUCCESS ||
+        statement_bind_text(&statement, 1, row->username) != PREPARE_SUCCESS ||
+        statement_bind_text(&statement, 2, row->email) != PREPARE_SUCCESS) {
+        fail("parameter did not bind", row->id);
+    }
+    return execute_statement(&statement, table);
+}
+
+// Returns false once the table is full. Half of the ids are appended past the
+// largest so far, as ids usually are, and some repeat one already inserted.
+bool stress_insert(Table* table, Model* model) {
+    Row row;
+    if (model->num_ids > 0 && next_random() % 16 == 0) {
+        uint32_t id = model->ids[next_random() % model->num_ids];
+        make_row(id, &row);
+        ExecuteResult result = execute_insert_row(&row, table);
+        if (result != EXECUTE_DUPLICATE_KEY) {
+            fail("duplicate insert was not rejected", id);
+        }
+        return true;
+    }
+
+    uint32_t id;
+    if (next_random() % 2 == 0 && model->max_id < STRESS_ID_SPACE - 64) {
+        id = model->max_id + 1 + next_random() % 8;
+    } else {
+        do {
+            id = next_random() % (STRESS_ID_SPACE - 1) + 1;
+        } while (model->present[id]);
+    }
+
+    make_row(id, &row);
+    ExecuteResult result = next_random() % 4 == 0 ? insert_prepared(table, &row) : execute_insert_row(&row, table);
+    if (result == EXECUTE_TABLE_FULL) {
+        return false;
+    }
+    if (result != EXECUTE_SUCCESS) {
+        fail("insert failed", id);
+    }
+    model->present[id] = 1;
+    model->ids[model->num_ids++] = id;
+    if (id > model->max_id) {
+        model->max_id = id;
+    }
+    return true;
+}
+
+// Groups a few inserts into a transaction. Returns false once the table is
+// full.
+bool stress_transaction(Table* table, Model* model) {
+    if (db_begin(table) != EXECUTE_SUCCESS) {
+        fail("transaction did not begin", 0);
+    }
+    if (db_begin(table) != EXECUTE_FAILURE) {
+        fail("transaction began inside another", 0);
+    }
+    bool inserted = true;
+    for (uint32_t i = next_random() % 16; inserted && i > 0; i--) {
+        inserted = stress_insert(table, model);
+    }
+    if (db_commit(table) != EXECUTE_SUCCESS) {
+        fail("transaction did not commit", 0);
+    }
+    if (db_commit(table) != EXECUTE_FAILURE) {
+        fail("commit outside a transaction succeeded", 0);
+    }
+    return inserted;
+}
+
+void stress_lookup(Table* table, Model* model) {
+    Row row;
+    if (model->num_ids > 0 && next_random() % 4 != 0) {
+        uint32_t id = model->ids[next_random() % model->num_ids];
+        if (!db_get(table, id, &row)) {
+            fail("row is missing", id);
+        }
+        check_row(&row, id);
+    } else {
+        uint32_t id = next_random() % (STRESS_ID_SPACE - 1) + 1;
+        if (db_get(table, id, &row) != model->present[id]) {
+            fail("lookup disagrees with the model", id);
+        }
+    }
+}
+
+// Looks a row up through a where clause, which uses the index if there is one
+void stress_filter(Table* table, Model* model) {
+    uint32_t id = next_random() % (STRESS_ID_SPACE - 1) + 1;
+    if (model->num_ids > 0 && next_random() % 2 == 0) {
+        id = model->ids[next_random() % model->num_ids];
+    }
+    Row row;
+    make_row(id, &row);
+    char sql[320];
+    if (next_random() % 2 == 0) {
+        snprintf(sql, sizeof(sql), "select where email = %s", row.email);
+    } else {
+        snprintf(sql, sizeof(sql), "select where username = %s", row.username);
+    }
+    if (run_statement(table, sql, EXECUTE_SUCCESS) != model->present[id]) {
+        fail("filter disagrees with the model", id);
+    }
+}
+
+void stress_create_index(Table* table, Model* model) {
+    StringColumn column = next_random() % NUM_STRING_COLUMNS;
+    const char* sql = column == COLUMN_EMAIL ? "create index on email" : "create index on username";
+    Statement statement;
+    statement_prepare(sql, &statement);
+    ExecuteResult result = execute_statement(&statement, table);
+    if (model->indexed[column] ? result != EXECUTE_INDEX_EXISTS :
+        result != EXECUTE_SUCCESS && result != EXECUTE_TABLE_FULL) {
+        fail("create index gave the wrong result", 0);
+    }
+    model->indexed[column] |= (result == EXECUTE_SUCCESS);
+}
+
+// Every row in the table is in the model, once and in id order, the counts
+// agree, and seeking to a row by its offset finds the row the scan did
+void stress_scan(Table* table, Model* model) {
+    uint8_t* seen = calloc(STRESS_ID_SPACE, 1);
+    uint32_t num_rows = 0;
+    uint32_t offset = next_random() % (model->num_ids + 1);
+    uint32_t offset_id = 0;
+    uint8_t last_value[ROW_SIZE];
+    Row row;
+    Cursor cursor;
+    table_start_cursor(table, &cursor);
+    while (!cursor.end_of_table) {
+        void* value = cursor_value(&cursor);
+        deserialize_row(value, &row);
+        if (row.id == 0 || row.id >= STRESS_ID_SPACE || !model->present[row.id] || seen[row.id]) {
+            fail("scan found a row not in the model", row.id);
+        }
+        if (num_rows > 0 && row_compare_id(last_value, value) >= 0) {
+            fail("scan is out of order", row.id);
+        }
+        check_row(&row, row.id);
+        if (num_rows == offset) {
+            offset_id = row.id;
+        }
+        memcpy(last_value, value, ROW_SIZE);
+        seen[row.id] = 1;
+        num_rows++;
+        cursor_advance(&cursor);
+    }
+    cursor_close(&cursor);
+    free(seen);
+    if (num_rows != model->num_ids) {
+        fail("scan found too few rows", num_rows);
+    }
+    table_offset_cursor(table, offset, &cursor);
+    if (cursor.end_of_table != (offset == num_rows)) {
+        fail("offset seek ended in the wrong place", offset);
+    }
+    if (!cursor.end_of_table) {
+        deserialize_row(cursor_value(&cursor), &row);
+        if (row.id != offset_id) {
+            fail("offset seek found the wrong row", row.id);
+        }
+    }
+    cursor_close(&cursor);
+    if (run_statement(table, "select", EXECUTE_SUCCESS) != model->num_ids) {
+        fail("select disagrees with the model", model->num_ids);
+    }
+}
+
+// A file being filled by the writer while readers check it. The writer
+// inserts each row in turn, so a snapshot should hold the first rows inserted
+// and no others.
+typedef struct {
+    Table* table;
+    uint32_t* ids; // in the order inserted
+    uint32_t* positions; // by id, one past where it is in ids, or 0
+    uint32_t num_started; // inserts begun, which no snapshot sees more than
+    uint32_t num_committed; // inserts done, which every later snapshot sees
+    bool done;
+} Concurrent;
+
+typedef struct {
+    Concurrent* concurrent;
+    uint64_t random_state;
+    uint32_t num_snapshots;
+} Reader;
+
+// Reads the table in one snapshot through a scan, select count(*), lookups and
+// an offset seek, and checks they all see the same rows
+void check_snapshot(Reader* reader) {
+    Concurrent* concurrent = reader->concurrent;
+    Table* table = concurrent->table;
+    uint32_t num_committed = __atomic_load_n(&(concurrent->num_committed), __ATOMIC_ACQUIRE);
+    db_begin_snapshot(table);
+    uint32_t num_started = __atomic_load_n(&(concurrent->num_started), __ATOMIC_ACQUIRE);
+
+    uint32_t offset = next_random_from(&(reader->random_state)) % (num_committed + 1);
+    uint32_t offset_id = 0;
+    uint32_t num_rows = 0;
+    uint32_t last_id = 0;
+    Row row;
+    Cursor cursor;
+    table_start_cursor(table, &cursor);
+    while (!cursor.end_of_table) {
+        deserialize_row(cursor_value(&cursor), &row);
+        if (row.id >= STRESS_ID_SPACE || concurrent->positions[row.id] == 0 ||
+            concurrent->positions[row.id] > num_started) {
+            fail("snapshot holds a row not yet inserted", row.id);
+        }
+        if (row.id <= last_id) {
+            fail("snapshot scan is out of order", row.id);
+        }
+        check_row(&row, row.id);
+        if (num_rows == offset) {
+            offset_id = row.id;
+        }
+        last_id = row.id;
+        num_rows++;
+        cursor_advance(&cursor);
+    }
+    cursor_close(&cursor);
+    if (num_rows < num_committed || num_rows > num_started) {
+        fail("snapshot holds the wrong number of rows", num_rows);
+    }
+    // Rows are distinct, so all being among the first num_rows makes them those
+    for (uint32_t i = 0; i < num_rows; i++) {
+        if (concurrent->positions[concurrent->ids[i]] > num_rows) {
+            fail("snapshot skipped a row", concurrent->ids[i]);
+        }
+    }
+
+    if (run_statement(table, "select", EXECUTE_SUCCESS) != num_rows) {
+        fail("select disagrees with the snapshot", num_rows);
+    }
+    // count(*) returns its count as one row, having examined every row
+    Statement statement;
+    statement_prepare("select count(*)", &statement);
+    if (execute_statement(&statement, table) != EXECUTE_SUCCESS || statement.rows_examined != num_rows) {
+        fail("select count(*) disagrees with the snapshot", num_rows);
+    }
+    if (num_rows > 0 && !db_get(table, concurrent->ids[next_random_from(&(reader->random_state)) % num_rows], &row)) {
+        fail("snapshot lookup missed a row", row.id);
+    }
+    if (num_rows < num_started && db_get(table, concurrent->ids[num_rows], &row)) {
+        fail("snapshot lookup found a later row", row.id);
+    }
+    table_offset_cursor(table, offset, &cursor);
+    if (offset < num_rows && (cursor.end_of_table ||
+        (deserialize_row(cursor_value(&cursor), &row), row.id != offset_id))) {
+        fail("snapshot offset seek found the wrong row", offset);
+    }
+    cursor_close(&cursor);
+    db_end_snapshot(table);
+    reader->num_snapshots++;
+}
+
+void* run_reader(void* arg) {
+    Reader* reader = arg;
+    while (!__atomic_load_n(&(reader->concurrent->done), __ATOMIC_ACQUIRE)) {
+        check_snapshot(reader);
+    }
+    check_snapshot(reader);
+    return NULL;
+}
+
+// Fills a file while readers check it, returning the snapshots they took
+uint32_t stress_concurrent(uint64_t num_tables, uint32_t* ids, uint32_t* positions) {
+    remove_db_file(HARNESS_DB_FILE);
+    memset(positions, 0, sizeof(uint32_t)*STRESS_ID_SPACE);
+    open_flags = num_tables % 2 == 0 ? DB_OPEN_DEFAULT : DB_OPEN_COMPRESSED;
+    scan_threads = STRESS_SCAN_THREADS;
+    Concurrent concurrent = { open_file(), ids, positions, 0, 0, false };
+
+    Reader readers[STRESS_READERS];
+    pthread_t threads[STRESS_READERS];
+    for (uint32_t i = 0; i < STRESS_READERS; i++) {
+        readers[i].concurrent = &concurrent;
+        readers[i].random_state = next_random() | 1;
+        readers[i].num_snapshots = 0;
+        if (pthread_create(&(threads[i]), NULL, run_reader, &(readers[i])) != 0) {
+            fail("reader did not start", i);
+        }
+    }
+
+    uint32_t max_id = 0;
+    for (uint32_t num_ids = 0; ; num_ids++) {
+        uint32_t id;
+        if (next_random() % 4 != 0 && max_id < STRESS_ID_SPACE - 64) {
+            id = max_id + 1 + next_random() % 8;
+        } else {
+            do {
+                id = next_random() % (STRESS_ID_SPACE - 1) + 1;
+            } while (positions[id] != 0);
+        }
+        ids[num_ids] = id;
+        positions[id] = num_ids + 1;
+        __atomic_store_n(&(concurrent.num_started), num_ids + 1, __ATOMIC_RELEASE);
+
+        Row row;
+        make_row(id, &row);
+        ExecuteResult result = execute_insert_row(&row, concurrent.table);
+        if (result == EXECUTE_TABLE_FULL) {
+            // Readers may see the row started, but never in a snapshot
+            break;
+        }
+        if (result != EXECUTE_SUCCESS) {
+            fail("concurrent insert failed", id);
+        }
+        __atomic_store_n(&(concurrent.num_committed), num_ids + 1, __ATOMIC_RELEASE);
+        if (id > max_id) {
+            max_id = id;
+        }
+    }
+
+    __atomic_store_n(&(concurrent.done), true, __ATOMIC_RELEASE);
+    uint32_t num_snapshots = 0;
+    for (uint32_t i = 0; i < STRESS_READERS; i++) {
+        pthread_join(threads[i], NULL);
+        num_snapshots += readers[i].num_snapshots;
+    }
+    db_close(concurrent.table);
+    return num_snapshots;
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t num_operations = STRESS_DEFAULT_OPERATIONS;
+    random_state = 0x9e3779b97f4a7c15ull;
+    if (argc > 3) {
+        printf("Usage: %s [<operations> [<seed>]]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 1) {
+        num_operations = strtoull(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        random_state = strtoull(argv[2], NULL, 10) | 1;
+    }
+
+    // Selects print what they match, which is not wanted here
+    FILE* results = fdopen(dup(fileno(stdout)), "w");
+    if (results == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "Unable to redirect output.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    statement_cache = new_statement_cache();
+    Model model;
+    model.present = malloc(STRESS_ID_SPACE);
+    model.ids = malloc(sizeof(uint32_t)*STRESS_ID_SPACE);
+    uint64_t num_tables = 0;
+    Table* table = open_empty(&model, num_tables++);
+    uint64_t num_reopens = 0;
+
+    for (operation = 0; operation < num_operations; operation++) {
+        uint32_t choice = next_random() % 1000;
+        if (choice < 400 || choice == 999) {
+            bool inserted = choice < 400 ? stress_insert(table, &model) : stress_transaction(table, &model);
+            if (!inserted) {
+                stress_scan(table, &model);
+                db_close(table);
+                table = open_empty(&model, num_tables++);
+            }
+        } else if (choice < 800) {
+            stress_lookup(table, &model);
+        } else if (choice < 950) {
+            stress_filter(table, &model);
+        } else if (choice < 952) {
+            stress_create_index(table, &model);
+        } else if (choice < 990) {
+            stress_scan(table, &model);
+        } else {
+            db_close(table);
+            check_file_size();
+            table = open_file();
+            num_reopens++;
+        }
+    }
+    stress_scan(table, &model);
+    db_close(table);
+
+    uint32_t* positions = malloc(sizeof(uint32_t)*STRESS_ID_SPACE);
+    uint64_t num_snapshots = 0;
+    for (uint32_t i = 0; i < STRESS_CONCURRENT_FILES; i++) {
+        num_snapshots += stress_concurrent(num_tables++, model.ids, positions);
+    }
+    free(positions);
+    remove_db_file(HARNESS_DB_FILE);
+
+    fprintf(results, "stress: passed (%llu operations, %llu tables, %llu reopens, %llu concurrent snapshots)\n",
+            (unsigned long long)num_operations, (unsigned long long)num_tables,
+            (unsigned long long)num_reopens, (unsigned long long)num_snapshots);
+    fclose(results);
+    close_statement_cache(statement_cache);
+    free(model.present);
+    free(model.ids);
+    return 0;
+}